@@ -0,0 +1,783 @@
+/**
+ * CGM parser. Reads a CGM document line by line and passes its contents to
+ * an emitter.
+ *
+ * @author Joel Lehtonen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "utf8.h"
+#include "mmap.h"
+#include "decompress.h"
+#include "cgm_error.h"
+#include "cgm_memory.h"
+#include "cgm_symbols.h"
+#include "cgm.h"
+
+#define MAX_LEVELS 10 // hard-wired indent levels... blame me.
+
+struct level {
+	int indent;        // indentation of that level. Every level except
+	                   // the first one has its parent element open.
+	int selected;      // elements of this level go to the emitter
+};
+
+// Path filter, see struct cgm_options
+struct cgm_filter {
+	struct {
+		const char *name;
+		int length;
+	} parts[MAX_LEVELS];
+	int count;
+};
+
+static const int tab_width = 8; // May be nice if configurable
+static const int cgm_empty_line = -1;
+// Default limit of decompressed size per compressed byte. About the best
+// ratio of deflate, so only crafted zstd input goes over it.
+static const size_t decompress_ratio = 1024;
+
+static int cgm_parse(struct cgm_info *cgm, const char *original,
+		     const struct cgm_options *options,
+		     struct cgm_emitter *emitter,
+		     struct mmap_info *mmap_info);
+static int cgm_parse_plain(struct cgm_info *cgm, const char *original,
+			   const struct cgm_options *options,
+			   struct cgm_emitter *emitter,
+			   struct mmap_info *mmap_info);
+static int cgm_parse_lines(struct cgm_info *cgm, const char *original,
+			   struct cgm_emitter *emitter,
+			   struct mmap_info *mmap_info,
+			   struct cgm_symbols *symbols,
+			   const struct cgm_filter *filter);
+static unsigned char *cgm_skip_subtree(struct cgm_info *cgm, int indent);
+static int cgm_read_preformatted(struct cgm_info *cgm, int indent,
+				 unsigned char **text);
+
+/**
+ * Parses a CGM file and passes its contents to the given emitter. The
+ * mapping of the input is released every time the parser returns to
+ * indentation level 0, so the memory usage depends on the emitter only.
+ * Gzip and zstd compressed files are decompressed to memory first, once.
+ * Compressed data inside compressed data is an error, and so is going over
+ * the decompressed size limit of options.
+ * Options may be NULL for defaults.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+int cgm_parse_file(const char *filename, const struct cgm_options *options,
+		   struct cgm_emitter *emitter) {
+	struct cgm_info cgm;
+	cgm_error.line = 0;
+	cgm_error.offset = 0;
+
+	// Opening CGM file to memory
+	struct mmap_info mmap_info = mmap_fopen(filename,
+						mmap_mode_volatile_write);
+	if (mmap_info.state == mmap_state_error)
+		return_with_error(0, cgm_err_file_open, 1);
+
+	// Filling info from mmap struct to cgm parser struct
+	cgm.p = mmap_info.data;
+	cgm.endptr = cgm.p + mmap_info.length;
+
+	cgm_parse(&cgm, filename, options, emitter, &mmap_info);
+	if (cgm_error.code) {
+		mmap_close(&mmap_info);
+		return 0; // error occurred
+	}
+
+	mmap_close(&mmap_info);
+	if (mmap_info.state == mmap_state_error)
+		return_with_error(0, cgm_err_file_close, has_errno);
+
+	return_success(0);
+}
+
+/**
+ * Parses a CGM document of given length from memory and passes its contents
+ * to the given emitter. The buffer is not altered. 'original' is passed to
+ * the emitter as the file name of the document. Compressed data is handled
+ * like in cgm_parse_file(). Options may be NULL for defaults. The parser
+ * has no shared state, cgm_error included, so threads may parse different
+ * buffers at the same time, each with its own emitter. The XML emitter
+ * initializes libxml2 once by itself. Only cgm_memory_setup(), if used,
+ * must be called before the first thread starts.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+int cgm_parse_buffer(const unsigned char *data, size_t length,
+		     const char *original, const struct cgm_options *options,
+		     struct cgm_emitter *emitter)
+{
+	struct cgm_info cgm;
+	cgm_error.line = 0;
+	cgm_error.offset = 0;
+
+	// The parser only reads through cgm.p
+	cgm.p = (unsigned char *)data;
+	cgm.endptr = cgm.p + length;
+
+	return cgm_parse(&cgm, original, options, emitter, NULL);
+}
+
+/**
+ * The actual parser. Buffer is set in cgm->p and cgm->endptr. If mmap_info
+ * is not NULL, the pages already parsed are released from it. Compressed
+ * buffer is decompressed to anonymous memory which is parsed and released
+ * the same way instead. Decompressed data must not be compressed again.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+static int cgm_parse(struct cgm_info *cgm, const char *original,
+		     const struct cgm_options *options,
+		     struct cgm_emitter *emitter,
+		     struct mmap_info *mmap_info)
+{
+	struct mmap_info plain;
+
+	if (decompress_detect(cgm->p, cgm->endptr - cgm->p) !=
+	    decompress_none) {
+		size_t length = cgm->endptr - cgm->p;
+		size_t limit = options != NULL ? options->max_decompressed : 0;
+		if (limit == 0) limit = length > SIZE_MAX / decompress_ratio ?
+				SIZE_MAX : length * decompress_ratio;
+
+		plain = decompress(cgm->p, length,
+				   options != NULL ? options->threads : 0,
+				   limit);
+		if (plain.state == mmap_state_error) {
+			if (errno == ENOMEM)
+				return_with_error(0, cgm_err_memory,
+						  has_errno);
+			if (errno == EFBIG)
+				return_with_error(0,
+						  cgm_err_decompressed_limit,
+						  no_errno);
+			return_with_error(0, cgm_err_compressed, no_errno);
+		}
+
+		// Compressed data is not needed anymore.
+		if (mmap_info != NULL) mmap_discard(mmap_info,
+						    mmap_info->length);
+
+		// Compression is unwrapped once. Nested compression is a
+		// mistake, bombs are stopped by the size limit above.
+		if (decompress_detect(plain.data, plain.length) !=
+		    decompress_none) {
+			mmap_close(&plain);
+			return_with_error(0, cgm_err_compressed, no_errno);
+		}
+
+		cgm->p = plain.data;
+		cgm->endptr = cgm->p + plain.length;
+		cgm_parse_plain(cgm, original, options, emitter, &plain);
+		mmap_close(&plain);
+		return 0;
+	}
+
+	return cgm_parse_plain(cgm, original, options, emitter, mmap_info);
+}
+
+/**
+ * Parser of uncompressed data, see cgm_parse(). Element names are interned
+ * in a symbol table which lives as long as the parsing.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+static int cgm_parse_plain(struct cgm_info *cgm, const char *original,
+			   const struct cgm_options *options,
+			   struct cgm_emitter *emitter,
+			   struct mmap_info *mmap_info)
+{
+	struct cgm_symbols symbols;
+	struct cgm_filter filter;
+
+	// Splitting the path to names
+	filter.count = 0;
+	if (options != NULL && options->path != NULL &&
+	    *options->path != '\0') {
+		const char *p = options->path;
+		while (1) {
+			if (filter.count == MAX_LEVELS)
+				return_with_error(0, cgm_err_too_deep,
+						  no_errno);
+			filter.parts[filter.count].name = p;
+			filter.parts[filter.count].length = strcspn(p, "/");
+			p += filter.parts[filter.count].length;
+			filter.count++;
+			if (*p++ == '\0') break;
+		}
+	}
+
+	if (cgm_symbols_init(&symbols) == -1)
+		return_with_error(0, cgm_err_memory, has_errno);
+
+	// Text lines are blocks, having the first ID.
+	if (cgm_symbols_intern(&symbols, (unsigned char *)"block", 5) == -1) {
+		cgm_symbols_free(&symbols);
+		return_with_error(0, cgm_err_memory, has_errno);
+	}
+
+	cgm->scratch = NULL;
+	cgm->scratch_alloc = 0;
+
+	cgm_parse_lines(cgm, original, emitter, mmap_info, &symbols,
+			filter.count ? &filter : NULL);
+
+	free(cgm->scratch);
+	cgm_symbols_free(&symbols);
+	return 0;
+}
+
+/**
+ * Line parser of cgm_parse(). If filter is not NULL, only the elements at
+ * its path and their subtrees are emitted. Everything else is skipped
+ * without decoding.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+static int cgm_parse_lines(struct cgm_info *cgm, const char *original,
+			   struct cgm_emitter *emitter,
+			   struct mmap_info *mmap_info,
+			   struct cgm_symbols *symbols,
+			   const struct cgm_filter *filter)
+{
+	struct level levels[MAX_LEVELS];
+	struct level *cur_level = levels; // pointer to the first element 
+	unsigned char *start = cgm->p; // offsets are counted from here
+
+	// Some extra info for nicer errors
+	cgm->lineptr = cgm->p;
+	cgm->line = 1;
+
+	// Filling trivial data to the unicode values
+	// It's safe to put ASCII literals here, values map to unicodes
+	cgm->unicode.newline = '\n'; 
+	cgm->unicode.tab     = '\t';
+	cgm->unicode.space   = ' ';
+
+	// Parsing header
+	cgm_read_header(cgm);
+	if (cgm_error.code) return 0; // ERROR
+	cgm->line++;
+
+	emitter->start_document(emitter->data, original);
+	if (cgm_memory_exceeded())
+		return_with_error(0, cgm_err_memory_limit, no_errno);
+
+	// Set indentation level 
+	cur_level->indent = 0;
+	cur_level->selected = filter == NULL;
+
+	// Line parser. Every line is an element (text lines are blocks)
+	// which stays open until we know the next line is not its child.
+
+	int line_open = 0;
+	int line_emitted = 0;
+
+	while (cgm->p < cgm->endptr) {
+		cgm_error.line = cgm->line;
+		cgm_error.offset = cgm->p - start;
+		cgm->lineptr = cgm->p;
+
+		// Determining line indent
+		int indent = cgm_read_indent(cgm);
+		if (cgm_error.code) return 0; // error occurred
+
+		// Indentation
+		if (indent == cgm_empty_line) {
+			cgm->line++;
+			continue;
+		}
+
+		if ( indent > cur_level->indent ) {
+			// Indent has increased. Previous line is the parent.
+			if (!line_open)
+				return_with_error(0, cgm_err_indentation,
+						  no_errno);
+			if (cur_level == levels + MAX_LEVELS - 1)
+				return_with_error(0, cgm_err_too_deep,
+						  no_errno);
+			cur_level++;
+			cur_level->indent = indent;
+			cur_level->selected = line_emitted;
+		} else {
+			// Same or decreased indent. Previous line is complete.
+			if (line_open && line_emitted)
+				emitter->end_element(emitter->data);
+
+			// Search for matching indentation level
+			while (indent < cur_level->indent) {
+				if (cur_level->selected)
+					emitter->end_element(emitter->data);
+				cur_level--;
+			}
+			
+			// If it's not matching then we have a syntax error
+			if ( indent != cur_level->indent )
+				return_with_error(0, cgm_err_indentation,
+						  no_errno);
+		}
+		line_open = 0;
+
+		// Back at the top level, so the input before this line is
+		// never read again.
+		if (cur_level == levels && mmap_info != NULL)
+			mmap_discard(mmap_info,
+				     cgm->lineptr - (unsigned char *)mmap_info->data);
+		
+		unsigned char *text_p = NULL;
+		int text_length = 0;
+		int preformatted = 0;
+		struct cgm_element element;
+
+		// Look for element start
+		int is_element = cgm_is_this(cgm, cgm->unicode.element_start);
+		if (cgm_error.code) return 0; // error occurred
+
+		if (is_element) {
+			// Read element name
+			element = cgm_read_element_name(cgm);
+			if (cgm_error.code) return 0; // error occurred
+
+			// Skip the separator or element end
+			utf8_to_unicode(&cgm->p, cgm->endptr);
+
+			if (element.is_inline) {
+				// Contents are between separator and end,
+				// eg. [el|THIS]
+				text_length = cgm_read_text(
+					cgm, cgm->unicode.element_end, &text_p);
+				if (cgm_error.code) return 0;
+
+				if (!cgm_is_this(cgm, cgm->unicode.element_end))
+					return_with_error(0, cgm_err_element,
+							  no_errno);
+			}
+
+			// Skip whitespace before immediate contents,
+			// eg. [el] THIS
+			while (cgm_is_this(cgm, cgm->unicode.space) ||
+			       cgm_is_this(cgm, cgm->unicode.tab));
+
+			unsigned char *rest_p;
+			int rest_length = cgm_read_text(cgm,
+							cgm->unicode.newline,
+							&rest_p);
+			if (cgm_error.code) return 0; // error occurred
+
+			if (element.is_inline) {
+				// Nothing is allowed after inline element
+				if (rest_length)
+					return_with_error(0, cgm_err_garbage,
+							  no_errno);
+			} else {
+				text_p = rest_p;
+				text_length = rest_length;
+			}
+		} else {
+			// Preformatted block has already its subtree read.
+			preformatted = cgm_read_preformatted(cgm, indent,
+							     &text_p);
+			if (cgm_error.code) return 0;
+			if (preformatted != -1) {
+				text_length = preformatted;
+				preformatted = 1;
+			} else {
+				preformatted = 0;
+				text_length = cgm_read_text(
+					cgm, cgm->unicode.newline, &text_p);
+				if (cgm_error.code) return 0;
+			}
+		}
+
+		// Outside selected subtrees only the elements on the path
+		// are looked at. Anything else is skipped with its subtree.
+		int emit = cur_level->selected;
+		if (!emit) {
+			int depth = cur_level - levels;
+			if (!is_element ||
+			    element.name_length != filter->parts[depth].length ||
+			    memcmp(element.name, filter->parts[depth].name,
+				   element.name_length)) {
+				if (!preformatted) cgm_skip_subtree(cgm, indent);
+				continue;
+			}
+			emit = depth == filter->count - 1;
+		}
+
+		if (emit) {
+			int id = CGM_SYMBOL_BLOCK;
+			if (is_element) {
+				id = cgm_symbols_intern(symbols, element.name,
+							element.name_length);
+				if (id == -1)
+					return_with_error(0, cgm_err_memory,
+							  has_errno);
+			}
+
+			const struct cgm_symbol *sym = &symbols->symbols[id];
+			emitter->start_element(emitter->data, id, sym->name,
+					       sym->length);
+			if (text_length)
+				emitter->text(emitter->data, text_p,
+					      text_length);
+		}
+		line_open = 1;
+		line_emitted = emit;
+
+		// Emitter couldn't allocate all of this line.
+		if (cgm_memory_exceeded())
+			return_with_error(0, cgm_err_memory_limit, no_errno);
+
+		// Already at the next line
+		if (preformatted) continue;
+
+		// Take the newline out.
+		utf8_to_unicode(&cgm->p, cgm->endptr); // FIXME doesn't check...
+		cgm->line++;
+	}
+
+	// End of file closes everything
+	if (line_open && line_emitted) emitter->end_element(emitter->data);
+	for (; cur_level > levels; cur_level--) {
+		if (cur_level->selected) emitter->end_element(emitter->data);
+	}
+
+	emitter->end_document(emitter->data);
+	if (cgm_memory_exceeded())
+		return_with_error(0, cgm_err_memory_limit, no_errno);
+
+	return_success(0);
+}
+
+/**
+ * Skips the subtree of the current line. At the beginning cgm->p is at the
+ * end of the line having given indent. At the end cgm->p is at the
+ * beginning of the next line with the same or smaller indent. Lines between
+ * are not decoded at all, just scanned for newlines. That's fine because
+ * newline, space and tab are ASCII, never part of other UTF-8 characters
+ * and utf8_to_unicode() rejects their overlong encodings.
+ * Returns the end of the last line having content, or the original
+ * position if there is none.
+ */
+static unsigned char *cgm_skip_subtree(struct cgm_info *cgm, int indent)
+{
+	const unsigned char newline = cgm->unicode.newline;
+	const unsigned char space = cgm->unicode.space;
+	const unsigned char tab = cgm->unicode.tab;
+	unsigned char *last = cgm->p;
+
+	while (1) {
+		unsigned char *nl = memchr(cgm->p, newline,
+					   cgm->endptr - cgm->p);
+		if (nl == NULL) {
+			if (cgm->p < cgm->endptr) last = cgm->endptr;
+			cgm->p = cgm->endptr;
+			return last;
+		}
+		if (nl > cgm->p) last = nl; // Not just indentation
+		cgm->line++;
+
+		// Counting indentation of the next line like cgm_read_indent()
+		unsigned char *q = nl + 1;
+		int line_indent = 0;
+		for (; q < cgm->endptr; q++) {
+			if (*q == space)
+				line_indent++;
+			else if (*q == tab)
+				line_indent += tab_width -
+					(line_indent % tab_width);
+			else
+				break;
+		}
+
+		// Empty lines don't end the subtree
+		if (q < cgm->endptr && *q != newline && line_indent <= indent) {
+			cgm->p = nl + 1;
+			return last;
+		}
+		cgm->p = q;
+	}
+}
+
+/**
+ * Reads a preformatted block if the current line has only the preformatted
+ * character. Its subtree is the content, taken as it is without escapes,
+ * indentation included, up to the end of the last line having content.
+ * The content is only validated, not copied. At the end cgm->p is at the
+ * beginning of the next line with the same or smaller indent and the
+ * content is in 'text'. Returns the length of the content in bytes, or -1
+ * and leaves cgm->p untouched if the line is something else.
+ * Errors are passed with return_with_error().
+ */
+static int cgm_read_preformatted(struct cgm_info *cgm, int indent,
+				 unsigned char **text)
+{
+	unsigned char *p = cgm->p;
+	if (utf8_to_unicode(&p, cgm->endptr) != cgm->unicode.preformatted)
+		return -1;
+
+	unsigned char *end = p;
+	int code = utf8_to_unicode(&end, cgm->endptr);
+	if (code != UTF8_ERR_NO_DATA && code != cgm->unicode.newline)
+		return -1;
+
+	// Content starts from the line after the marker.
+	int line = cgm->line + 1;
+	cgm->p = p;
+	*text = end;
+	unsigned char *last = cgm_skip_subtree(cgm, indent);
+	if (last <= end) return_success(0);
+
+	// Same encoding is required as on the other lines.
+	for (p = end; p < last;) {
+		code = utf8_to_unicode(&p, last);
+		if (code == cgm->unicode.newline) {
+			line++;
+		} else if (code < 0) {
+			cgm_error.line = line;
+			return_with_error(0, cgm_err_invalid_byte, no_errno);
+		}
+	}
+	return_success(last - end);
+}
+
+/**
+ * Reads CGM header and fills the given cgm struct with all the important stuff.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+int cgm_read_header(struct cgm_info *cgm)
+{
+	cgm_error.line = 1;
+	
+	cgm->unicode.element_start = utf8_to_unicode(&cgm->p, cgm->endptr);
+
+	if (!( utf8_to_unicode(&cgm->p, cgm->endptr) == 'c' &&
+	       utf8_to_unicode(&cgm->p, cgm->endptr) == 'g' &&
+	       utf8_to_unicode(&cgm->p, cgm->endptr) == 'm' &&
+	       utf8_to_unicode(&cgm->p, cgm->endptr) == '1' ))
+	{
+		return_with_error(0, cgm_err_invalid_header, no_errno);
+	}
+
+	cgm->unicode.inline_separator = utf8_to_unicode(&cgm->p, cgm->endptr);
+	cgm->unicode.escape           = utf8_to_unicode(&cgm->p, cgm->endptr);
+	cgm->unicode.preformatted     = utf8_to_unicode(&cgm->p, cgm->endptr);
+	cgm->unicode.element_end      = utf8_to_unicode(&cgm->p, cgm->endptr);
+
+	if (utf8_to_unicode(&cgm->p, cgm->endptr) != cgm->unicode.newline)
+		return_with_error(0, cgm_err_garbage, no_errno);
+
+	return_success(0);
+}
+
+/**
+ * Count indentation level. If the line has no content, this function returns
+ * -1 and cgm->p is at the beginning of the following line.
+ */
+int cgm_read_indent(struct cgm_info *cgm)
+{
+	unsigned char *prev_p;
+	int indent = 0;
+
+	while (1) {
+		prev_p = cgm->p;
+		int code = utf8_to_unicode(&cgm->p, cgm->endptr);
+		
+		if (code == UTF8_ERR_NO_DATA ||
+		    code == cgm->unicode.newline ) {
+			// Line has no content
+			return_success(cgm_empty_line);
+		} else if (code < 0) {
+			// Unexcepted error.
+			return_with_error(0, cgm_err_invalid_byte, no_errno);
+		} else if (code == cgm->unicode.space) {
+			indent++;
+		} else if (code == cgm->unicode.tab) {
+			// Rounding towards next tab (allows spaces to be mixed)
+			indent += tab_width - (indent % tab_width);
+		} else {
+			// Content starts. "Unget" last character
+			cgm->p = prev_p;
+			return_success(indent);
+		}
+	}
+}
+
+/**
+ * Dumps a line as tokens and Unicode values to standard output.
+ * Used for debugging purposes.
+ */
+int cgm_dummy_dumper(struct cgm_info *cgm)
+{
+	while (1) {
+
+		int code = utf8_to_unicode(&cgm->p, cgm->endptr);
+				
+		if (code == UTF8_ERR_NO_DATA) { // End of file
+			return_success(0);
+		} else if (code < 0) {
+			// Unexcepted error.
+			return_with_error(0, cgm_err_invalid_byte, no_errno);
+		} else if (code == cgm->unicode.element_start) {
+			printf("start\n");
+		} else if (code == cgm->unicode.element_end) {
+			printf("end\n");
+		} else if (code == cgm->unicode.escape) {
+			printf("escape\n");
+		} else if (code == cgm->unicode.inline_separator) {
+			printf("inline\n");
+		} else if (code == cgm->unicode.newline) {
+			printf("newline\n");
+			return_success(0);
+		} else if (code == cgm->unicode.tab) {
+			printf("tab\n");
+		} else if (code == cgm->unicode.space) {
+			printf("space\n");
+		} else {
+			printf("U+%x\n", code);
+		}
+	}
+}
+
+/**
+ * Appends bytes to the scratch buffer at given length. Returns -1 if out of
+ * memory.
+ */
+static int cgm_scratch_append(struct cgm_info *cgm, int length,
+			      const unsigned char *data, int n)
+{
+	if (n == 0) return 0; // scratch may still be NULL
+	if (length + n > cgm->scratch_alloc) {
+		int alloc = cgm->scratch_alloc ? cgm->scratch_alloc : 256;
+		while (alloc < length + n) alloc *= 2;
+		unsigned char *p = realloc(cgm->scratch, alloc);
+		if (p == NULL) return -1;
+		cgm->scratch = p;
+		cgm->scratch_alloc = alloc;
+	}
+	memcpy(cgm->scratch + length, data, n);
+	return 0;
+}
+
+/**
+ * This function reads content until next character is non-text like element
+ * boundary or newline. Parameter 'stop' is an extra character which ends
+ * the text, for example element end inside an inline element. Escape
+ * character makes the character after it a part of the text. Text without
+ * escapes is a slice of the input, text having them is unescaped to
+ * cgm->scratch which is reused by the next call. The text is set to 'text'
+ * and its length IN BYTES is returned. At the end of this call cgm->p
+ * points to the start of the next non-text character.
+ */
+int cgm_read_text(struct cgm_info *cgm, int stop, unsigned char **text)
+{
+	unsigned char *start = cgm->p;
+	unsigned char *p = cgm->p; // Current position in file.
+	unsigned char *run = NULL; // Start of bytes not in scratch yet.
+	int length = 0;            // Bytes in scratch.
+
+	*text = start;
+	while (1) {
+		unsigned char *char_p = p;
+		int code = utf8_to_unicode(&p, cgm->endptr);
+		
+		if (code == UTF8_ERR_NO_DATA ||
+		    code == cgm->unicode.newline ||
+		    code == stop ) {
+			// End has came
+			if (run == NULL) return_success(cgm->p - start);
+
+			if (cgm_scratch_append(cgm, length, run,
+					       cgm->p - run) == -1)
+				return_with_error(0, cgm_err_memory,
+						  has_errno);
+			*text = cgm->scratch;
+			return_success(length + (cgm->p - run));
+		} else if (code < 0) {
+			// Unexcepted error.
+			return_with_error(0, cgm_err_invalid_byte, no_errno);
+		} else if (code == cgm->unicode.escape) {
+			// Everything before the escape character goes to
+			// scratch and the escaped character starts a new run.
+			if (run == NULL) run = start;
+			if (cgm_scratch_append(cgm, length, run,
+					       char_p - run) == -1)
+				return_with_error(0, cgm_err_memory,
+						  has_errno);
+			length += char_p - run;
+			run = p;
+
+			code = utf8_to_unicode(&p, cgm->endptr);
+			if (code == UTF8_ERR_NO_DATA ||
+			    code == cgm->unicode.newline)
+				return_with_error(0, cgm_err_escape, no_errno);
+			if (code < 0)
+				return_with_error(0, cgm_err_invalid_byte,
+						  no_errno);
+		}
+		cgm->p = p; // Keeping cgm->p always one char before p.
+	}
+}
+
+/**
+ * Reads element name until inline separator or element end. At the end of
+ * this call cgm->p points to the separator or element end.
+ */
+struct cgm_element cgm_read_element_name(struct cgm_info *cgm)
+{
+	struct cgm_element element;
+	
+	element.name = cgm->p; // Starting point
+	unsigned char *p = cgm->p; // Current position in file.
+
+	while (1) {
+		int code = utf8_to_unicode(&p, cgm->endptr);
+		
+		if (code == UTF8_ERR_NO_DATA ||
+		    code == cgm->unicode.newline ) {
+			// Sudden end of line
+			return_with_error(element, cgm_err_element, no_errno);
+		} else if (code < 0) {
+			// Unexcepted error.
+			return_with_error(element, cgm_err_invalid_byte,
+					  no_errno);
+		} else if (code == cgm->unicode.element_end) {
+			element.name_length = cgm->p - element.name;
+			element.is_inline = 0;
+			return_success(element);
+		} else if (code == cgm->unicode.inline_separator) {
+			element.name_length = cgm->p - element.name;
+			element.is_inline = 1;
+			return_success(element);
+		}
+		cgm->p = p; // Keeping cgm->p always one char before p.
+	}
+}
+
+/**
+ * Returns 1 and moves forward if the next character is charcode. Otherwise
+ * returns 0 and leaves cgm->p untouched.
+ */
+int cgm_is_this(struct cgm_info *cgm, int charcode)
+{
+	unsigned char *p = cgm->p; // Current position in file.
+	int code = utf8_to_unicode(&p, cgm->endptr);
+		
+	if (code == UTF8_ERR_NO_DATA) {
+	  // End of file
+	  return_success(0);
+	} else if (code < 0) {
+	  // Unexcepted error.
+	  return_with_error(0, cgm_err_invalid_byte, no_errno);
+	} else if (code == charcode) {
+	  // Found. Go forward in the stream
+	  cgm->p = p;
+	  return_success(1);
+	}
+
+	return_success(0);
+}
+
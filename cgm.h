@@ -0,0 +1,133 @@
+#ifndef CGM_H
+#define CGM_H   1
+
+/**
+ * CGM parser. The parser reads a CGM document line by line and passes its
+ * contents to an emitter, see cgm_emitter.h. Errors are reported in
+ * cgm_error, see cgm_error.h.
+ *
+ * In text, the escape character of the header makes the next character
+ * literal, eg. "\[" is text and not an element. A line having only the
+ * preformatted character starts a preformatted block. Its more indented
+ * lines are passed as one text without any parsing.
+ */
+
+#include <stddef.h>
+#include "cgm_emitter.h"
+
+// Symbol ID of text blocks. See cgm_symbols.h
+#define CGM_SYMBOL_BLOCK 0
+
+struct cgm_unicode {
+	int element_start;
+	int element_end;
+	int escape;
+	int inline_separator;
+	int newline;
+	int tab;
+	int space;
+	int preformatted;
+};
+
+struct cgm_info {
+	struct cgm_unicode unicode;
+	unsigned char *p; // OK to alter.
+	unsigned char *endptr; // End of the buffer. Do not alter.
+	unsigned char *lineptr; // Helps printing line on error
+	int line; // Line number for error reporting purposes
+	unsigned char *scratch; // Unescaped text, see cgm_read_text()
+	int scratch_alloc;
+};
+
+struct cgm_element {
+	unsigned char *name;
+	int name_length;
+	int is_inline;
+};
+
+struct cgm_options {
+	// If not NULL, only elements at this path and their subtrees are
+	// emitted, as children of the document. Names are separated with
+	// '/', eg. "person/name". Text blocks never match. Other subtrees
+	// are skipped unparsed.
+	const char *path;
+
+	// Number of threads decompressing zstd input, 0 for one per CPU.
+	int threads;
+
+	// Largest size of decompressed input in bytes. Going over it is
+	// cgm_err_decompressed_limit. 0 for 1024 times the compressed size.
+	size_t max_decompressed;
+};
+
+/**
+ * Parses a CGM file and passes its contents to the given emitter. The
+ * mapping of the input is released every time the parser returns to
+ * indentation level 0, so the memory usage depends on the emitter only.
+ * Gzip and zstd compressed files are decompressed to memory first, once.
+ * Compressed data inside compressed data is an error, and so is going over
+ * the decompressed size limit of options.
+ * Options may be NULL for defaults.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+int cgm_parse_file(const char *filename, const struct cgm_options *options,
+		   struct cgm_emitter *emitter);
+
+/**
+ * Parses a CGM document of given length from memory and passes its contents
+ * to the given emitter. The buffer is not altered. 'original' is passed to
+ * the emitter as the file name of the document. Compressed data is handled
+ * like in cgm_parse_file(). Options may be NULL for defaults. The parser
+ * has no shared state, cgm_error included, so threads may parse different
+ * buffers at the same time, each with its own emitter. The XML emitter
+ * initializes libxml2 once by itself. Only cgm_memory_setup(), if used,
+ * must be called before the first thread starts.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+int cgm_parse_buffer(const unsigned char *data, size_t length,
+		     const char *original, const struct cgm_options *options,
+		     struct cgm_emitter *emitter);
+
+/**
+ * Reads CGM header and fills the given cgm struct with all the important stuff.
+ * Always returns 0. Errors are passed with return_with_error().
+ */
+int cgm_read_header(struct cgm_info *cgm);
+
+/**
+ * Count indentation level. If the line has no content, this function returns
+ * -1 and cgm->p is at the beginning of the following line.
+ */
+int cgm_read_indent(struct cgm_info *cgm);
+
+/**
+ * This function reads content until next character is non-text like element
+ * boundary or newline. Parameter 'stop' is an extra character which ends
+ * the text, for example element end inside an inline element. Escape
+ * character makes the character after it a part of the text. Text without
+ * escapes is a slice of the input, text having them is unescaped to
+ * cgm->scratch which is reused by the next call. The text is set to 'text'
+ * and its length IN BYTES is returned. At the end of this call cgm->p
+ * points to the start of the next non-text character.
+ */
+int cgm_read_text(struct cgm_info *cgm, int stop, unsigned char **text);
+
+/**
+ * Reads element name until inline separator or element end. At the end of
+ * this call cgm->p points to the separator or element end.
+ */
+struct cgm_element cgm_read_element_name(struct cgm_info *cgm);
+
+/**
+ * Dumps a line as tokens and Unicode values to standard output.
+ * Used for debugging purposes.
+ */
+int cgm_dummy_dumper(struct cgm_info *cgm);
+
+/**
+ * Returns 1 and moves forward if the next character is charcode. Otherwise
+ * returns 0 and leaves cgm->p untouched.
+ */
+int cgm_is_this(struct cgm_info *cgm, int charcode);
+
+#endif /* cgm.h */
@@ -9,82 +9,144 @@
  * @author Joel Lehtonen
  */
 
+#define _POSIX_C_SOURCE 200809L // for getopt()
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include <err.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
-#include "utf8.h"
 #include "mmap.h"
 #include "cgm_error.h"
+#include "cgm_memory.h"
+#include "cgm_emitter.h"
+#include "cgm_cache.h"
+#include "cgm_index.h"
+#include "cgm.h"
 
 #if defined(LIBXML_TREE_ENABLED) && defined(LIBXML_OUTPUT_ENABLED)
 
-const int MAX_LEVELS=10; // hard-wired indent levels... blame me.
-const int true = 1;
-
-struct level {
-	int indent;        // indentation of that level
-	xmlNodePtr parent; // parent node of this level
-};
-
-struct cgm_unicode {
-	int element_start;
-	int element_end;
-	int escape;
-	int inline_separator;
-	int newline;
-	int tab;
-	int space;
-	int preformatted;
-};
-
-struct cgm_info {
-	struct cgm_unicode unicode;
-	unsigned char *p; // OK to alter.
-	unsigned char *endptr; // End of the buffer. Do not alter.
-	unsigned char *lineptr; // Helps printing line on error
-	int line; // Line number for error reporting purposes
-};
-
-struct cgm_element {
-	unsigned char *name;
-	int name_length;
-	int is_inline;
-}
-
-const int tab_width = 8; // May be nice if configurable
-const int cgm_empty_line = -1;
+const off_t default_cache_limit = 256; // megabytes
+const int cache_version = 1; // Bump when the output of any format changes
 
-// for indentation count
-const int level_inline = -1;    // eg. [el|THIS]
-const int level_immediate = -2; // eg. [el] THIS
-
-// Prototypes are here temporarily
-xmlDocPtr cgm_parse_file(char *filename);
-int cgm_read_header(struct cgm_info *cgm);
-int cgm_read_indent(struct cgm_info *cgm);
-int cgm_read_text(struct cgm_info *cgm);
-struct cgm_element cgm_read_element_name(struct cgm_info *cgm)
-int cgm_dummy_dumper(struct cgm_info *cgm);
-int cgm_is_this(struct cgm_info *cgm, int charcode);
+struct cgm_emitter open_emitter(const char *format, FILE *out, int streaming);
+int convert_cached(const char *in_file, const char *format, int streaming,
+		    const struct cgm_options *options, FILE *out,
+		    const char *cache_dir, off_t cache_limit,
+		    struct cgm_index *index);
+struct cgm_emitter open_index(struct cgm_index *index,
+			      struct cgm_emitter *inner);
 
 int main(int argc, char **argv)
 {
-	if (argc < 2 || argc > 3) 
-		errx(1, "Usage: %s CGM_FILE [OUTPUT_FILE]", argv[0]);
+	int streaming = 0;
+	char *format = "xml";
+	char *cache_dir = NULL;
+	off_t cache_limit = default_cache_limit;
+	size_t memory_limit = 0;
+	int verbose = 0;
+	struct cgm_options options = { NULL, 0, 0 };
+	struct cgm_index index_storage;
+	struct cgm_index *index = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sf:c:l:p:ij:m:v")) != -1) {
+		switch (opt) {
+		case 's':
+			// Serialize top-level blocks as soon as they are ready
+			streaming = 1;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'c':
+			cache_dir = optarg;
+			break;
+		case 'l':
+			cache_limit = atol(optarg);
+			break;
+		case 'p':
+			options.path = optarg;
+			break;
+		case 'i':
+			index = &index_storage;
+			break;
+		case 'j':
+			options.threads = atoi(optarg);
+			break;
+		case 'm':
+			memory_limit = (size_t)atol(optarg) * 1024 * 1024;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
 
-	xmlDocPtr doc = cgm_parse_file(argv[1]);
-	if (cgm_error.code) cgm_err(1, argv[1]);
-	printf(":-)\n");
+	if (argc - optind < 1 || argc - optind > 2) goto usage;
+	char *in_file = argv[optind];
+	char *out_file = argc - optind > 1 ? argv[optind+1] : "-";
+
+	if (strcmp(format, "xml") && strcmp(format, "json") &&
+	    strcmp(format, "binary")) goto usage;
+
+	// Decompressed input is held in memory too.
+	options.max_decompressed = memory_limit;
+
+	// Libxml2 must not allocate anything before this.
+	if (cgm_memory_setup(memory_limit) == -1)
+		errx(1, "Can not set up memory accounting");
+	cgm_memory_reset();
+
+	// Index of a filtered document would not match the source file.
+	if (index != NULL && options.path != NULL) goto usage;
+	if (index != NULL && cgm_index_init(index) == -1)
+		err(1, "Can not allocate index");
+
+	FILE *out = strcmp(out_file, "-") ? fopen(out_file, "wb") : stdout;
+	if (out == NULL) err(1, "Can not open %s for writing", out_file);
+
+	if (cache_dir != NULL) {
+		int hit = convert_cached(in_file, format, streaming, &options,
+					 out, cache_dir,
+					 cache_limit * 1024 * 1024, index);
+		if (hit && index != NULL) {
+			// Output came from the cache so nothing was indexed.
+			struct cgm_emitter emitter = open_index(index, NULL);
+			cgm_parse_file(in_file, &options, &emitter);
+			if (cgm_error.code) cgm_err(1, in_file);
+			if (emitter.close(emitter.data) == -1)
+				err(1, "Can not index %s", in_file);
+		}
+	} else {
+		struct cgm_emitter emitter = open_emitter(format, out,
+							  streaming);
+		if (index != NULL) emitter = open_index(index, &emitter);
+
+		cgm_parse_file(in_file, &options, &emitter);
+		if (cgm_error.code) cgm_err(1, in_file);
+
+		if (emitter.close(emitter.data) == -1) {
+			if (cgm_memory_exceeded())
+				errx(1, "Memory limit exceeded while writing "
+				     "%s", out_file);
+			err(1, "Can not write to %s", out_file);
+		}
+	}
 
-	/* 
-	 * Dumping document to stdio or file
-	 */
-	xmlSaveFormatFileEnc(argc > 2 ? argv[2] : "-", doc, "UTF-8", 1);
+	if (fclose(out) == EOF) err(1, "Can not write to %s", out_file);
 
-	/*free the document */
-	xmlFreeDoc(doc);
+	if (index != NULL) {
+		if (cgm_index_save(index, in_file) == -1)
+			err(1, "Can not write index of %s", in_file);
+		cgm_index_free(index);
+	}
 
 	/*
 	 *Free the global variables that may
@@ -92,352 +154,138 @@ int main(int argc, char **argv)
 	 */
 	xmlCleanupParser();
 
-	/*
-	 * this is to debug memory for regression tests
-	 */
-	xmlMemoryDump();
-
-}
-
-xmlDocPtr cgm_parse_file(char *filename) {
-	struct cgm_info cgm;
-
-	xmlDocPtr doc = NULL;            // document pointer
-	struct level levels[MAX_LEVELS];
-	int cur_level_i = 0;
-	struct level *cur_level = levels; // pointer to the first element 
-
-	// Opening CGM file to memory
-	struct mmap_info mmap_info = mmap_fopen(filename,
-						mmap_mode_volatile_write);
-	if (mmap_info.state == mmap_state_error)
-		return_with_error(doc, cgm_err_file_open, 1);
-
-	// Filling info from mmap struct to cgm parser struct
-	cgm.p = mmap_info.data;
-	cgm.endptr = cgm.p + mmap_info.length;
-
-	// Some extra info for nicer errors
-	cgm.lineptr = cgm.p;
-	cgm.line = 1;
-
-	// Filling trivial data to the unicode values
-	// It's safe to put ASCII literals here, values map to unicodes
-	cgm.unicode.newline = '\n'; 
-	cgm.unicode.tab     = '\t';
-	cgm.unicode.space   = ' ';
-
-	// Parsing header
-	cgm_read_header(&cgm);
-	if (cgm_error.code) return doc; // ERROR
-
-	// DOM startup
-	
-	LIBXML_TEST_VERSION;
-	doc = xmlNewDoc(BAD_CAST "1.0"); // XML 1.0
-	
-	// Seems to be correct way to set root namespace. I found it by
-	// trial and error. Libxml2 folks have skipped documentation.
-	
-	xmlNodePtr root = xmlNewNode(NULL, BAD_CAST "cgm");
-	xmlNsPtr ns_CGM = xmlNewNs(root, 
-				   BAD_CAST "http://codegrove.org/2009/cgm",
-				   NULL);
-	xmlDocSetRootElement(doc, root);
-	xmlNewProp(root, BAD_CAST "original", BAD_CAST filename);
-
-	// Set indentation level 
-	cur_level->indent = 0;
-	cur_level->parent = root;
-
-	// Line parser.
-
-	xmlNodePtr last_node = NULL;
-
-	while (1) {
-
-		// Determining line indent
-		int indent = cgm_read_indent(&cgm);
-		if (cgm_error.code) return doc; // error occurred
-
-		// Indentation
-		if (indent == cgm_empty_line) {
-			printf("empty\n");
-			continue;
-		}
-
-		if ( indent == cur_level->indent ) {
-			// Just like previous line
-		} else if ( indent > cur_level->indent ) {
-			// Indent has increased.
-			// FIXME check if we need to allocate more memory
-			cur_level++;
-			cur_level->indent = indent;
-			cur_level->parent = last_node;
-		} else {
-			// Indent has decreased
-
-			// Search for matching indentation level
-			while (indent < cur_level->indent) {
-				cur_level--;
-			}
-			
-			// If it's not matching then we have a syntax error
-			if ( indent != cur_level->indent )
-				return_with_error(doc, cgm_err_indentation, 1);
-		}
-		
-		// Look for element start
-		if ( cgm_is_this(&cgm, cgm.unicode.element_start) ) {
-			// Read element name
-			struct cgm_element = cgm_read_element_name(&cgm);
-			if (cgm_error.code) return doc; // error occurred
-
-
-			xmlNodePtr new_el = xmlNewChild(cur_level->parent, NULL,
-							BAD_CAST "element",
-							NULL);
-			
-			// Indent has increased.
-			// FIXME check if we need to allocate more memory
-			cur_level++;
-			cur_level->parent = new_el;
-			
-			if (
-			cur_level->indent = level_immediate inline; // FIXME
-
-
-			
-			if
-
-			int text_length = 
-
-		// Put the element into the DOM tree
-
-		unsigned char *text_p = cgm.p;
-		int text_length = cgm_read_text(&cgm);
-		if (cgm_error.code) return doc; // error occurred
-		
-		printf("Bytes in that line: %d\n",text_length);
-
-		// Add new element to the tree.
-		xmlNodePtr new_text = xmlNewTextLen(text_p, text_length);
-		xmlNodePtr new_el = xmlNewChild(cur_level->parent, NULL,
-						BAD_CAST "block", NULL);
-		xmlAddChild(new_el, new_text);
-
-		last_node = new_el;
-		
-		// Insert arbitary newline to DOM
-		// TODO better place
-		xmlNodePtr cool_newline = xmlNewTextLen(BAD_CAST "\n", 1);
-		xmlAddChild(cur_level->parent, cool_newline);
-
-
-		// Take the newline out.
-		utf8_to_unicode(&cgm.p, cgm.endptr); // FIXME doesn't check...
-		
-		if (cgm.p >= cgm.endptr) break; // EOF
-	}
-	
-	/*
-	xmlNewChild(root_node, NULL, BAD_CAST "node1",
-		    BAD_CAST "content of node 1");
-
-	node =
-		xmlNewChild(root_node, NULL, BAD_CAST "node3",
-			    BAD_CAST "this node has attributes");
-	xmlNewProp(node, BAD_CAST "attribute", BAD_CAST "yes");
-	xmlNewProp(node, BAD_CAST "foo", BAD_CAST "bar");
-
-	node = xmlNewNode(NULL, BAD_CAST "node4");
-	node1 = xmlNewText(BAD_CAST
-
-			   */
-
-	mmap_close(&mmap_info);
-	if (mmap_info.state == mmap_state_error)
-		return_with_error(doc, cgm_err_file_close, has_errno);
-
-	return_success(doc);
+	// Output and the tree are freed, so live bytes should be zero.
+	if (verbose)
+		fprintf(stderr, "Memory: peak %lld bytes, live %lld bytes\n",
+			cgm_memory_peak(), cgm_memory_live());
+
+	return 0;
+usage:
+	errx(1, "Usage: %s [-s] [-f FORMAT] [-p PATH | -i] [-j THREADS] "
+	     "[-c DIR [-l MB]] [-m MB] [-v] "
+	     "CGM_FILE [OUTPUT_FILE]\n"
+	     "  -s  streaming XML output, keeps only one top-level block "
+	     "in memory\n"
+	     "  -f  output format: xml (default), json or binary\n"
+	     "  -p  output only elements at PATH, eg. person/name\n"
+	     "  -i  write element name index to CGM_FILE.idx\n"
+	     "  -j  threads decompressing zstd input (default: one per CPU)\n"
+	     "  -c  cache converted documents in DIR\n"
+	     "  -l  cache size limit in megabytes (default %d)\n"
+	     "  -m  memory limit of libxml2 and of decompressed input in "
+	     "megabytes\n"
+	     "      (default: none, decompressed 1024 times the input)\n"
+	     "  -v  print peak memory use of libxml2 to standard error",
+	     argv[0], (int)default_cache_limit);
 }
 
 /**
- * Reads CGM header and fills the given cgm struct with all the important stuff.
- * Always returns 0. Errors are passed with return_with_error().
+ * Opens an emitter of given format. Exits in case of error.
  */
-int cgm_read_header(struct cgm_info *cgm)
+struct cgm_emitter open_emitter(const char *format, FILE *out, int streaming)
 {
-	cgm_error.line = 1;
-	
-	cgm->unicode.element_start = utf8_to_unicode(&cgm->p, cgm->endptr);
-
-	if (!( utf8_to_unicode(&cgm->p, cgm->endptr) == 'c' &&
-	       utf8_to_unicode(&cgm->p, cgm->endptr) == 'g' &&
-	       utf8_to_unicode(&cgm->p, cgm->endptr) == 'm' &&
-	       utf8_to_unicode(&cgm->p, cgm->endptr) == '1' ))
-	{
-		return_with_error(0, cgm_err_invalid_header, no_errno);
-	}
-
-	cgm->unicode.inline_separator = utf8_to_unicode(&cgm->p, cgm->endptr);
-	cgm->unicode.escape           = utf8_to_unicode(&cgm->p, cgm->endptr);
-	cgm->unicode.preformatted     = utf8_to_unicode(&cgm->p, cgm->endptr);
-	cgm->unicode.element_end      = utf8_to_unicode(&cgm->p, cgm->endptr);
-
-	if (utf8_to_unicode(&cgm->p, cgm->endptr) != cgm->unicode.newline)
-		return_with_error(0, cgm_err_garbage, no_errno);
-
-	return_success(0);
+	struct cgm_emitter emitter;
+
+	if (strcmp(format, "json") == 0)
+		emitter = cgm_json_emitter(out);
+	else if (strcmp(format, "binary") == 0)
+		emitter = cgm_binary_emitter(out);
+	else
+		emitter = cgm_xml_emitter(out, streaming);
+
+	if (emitter.data == NULL) errx(1, "Can not initialize %s output",
+				       format);
+	return emitter;
 }
 
 /**
- * Count indentation level. If the line has no content, this function returns
- * -1 and cgm->p is at the beginning of the following line.
+ * Wraps inner emitter to one which also fills the index. If inner is NULL,
+ * the emitter only fills the index. Exits in case of error.
  */
-int cgm_read_indent(struct cgm_info *cgm)
+struct cgm_emitter open_index(struct cgm_index *index,
+			      struct cgm_emitter *inner)
 {
-	unsigned char *prev_p;
-	int indent = 0;
-
-	while (1) {
-		prev_p = cgm->p;
-		int code = utf8_to_unicode(&cgm->p, cgm->endptr);
-		
-		if (code == UTF8_ERR_NO_DATA ||
-		    code == cgm->unicode.newline ) {
-			// Line has no content
-			return_success(cgm_empty_line);
-		} else if (code < 0) {
-			// Unexcepted error.
-			return_with_error(0, cgm_err_invalid_byte, no_errno);
-		} else if (code == cgm->unicode.space) {
-			indent++;
-		} else if (code == cgm->unicode.tab) {
-			// Rounding towards next tab (allows spaces to be mixed)
-			indent += tab_width - (indent % tab_width);
-		} else {
-			// Content starts. "Unget" last character
-			cgm->p = prev_p;
-			return_success(indent);
-		}
-	}
+	struct cgm_emitter emitter = cgm_index_emitter(index, inner);
+
+	if (emitter.data == NULL) errx(1, "Can not initialize index");
+	return emitter;
 }
 
 /**
- * Dumps a line as tokens and Unicode values to standard output.
- * Used for debugging purposes.
+ * Converts in_file to out using the cache. On a hit the stored output is
+ * copied straight from the cache file without parsing. On a miss the output
+ * is written to a new cache entry first and copied from there. The index,
+ * if not NULL, is filled only on a miss. Returns 1 on a hit and 0 on a
+ * miss. Exits in case of error.
  */
-int cgm_dummy_dumper(struct cgm_info *cgm)
+int convert_cached(const char *in_file, const char *format, int streaming,
+		    const struct cgm_options *options, FILE *out,
+		    const char *cache_dir, off_t cache_limit,
+		    struct cgm_index *index)
 {
-	while (1) {
-
-		int code = utf8_to_unicode(&cgm->p, cgm->endptr);
-				
-		if (code == UTF8_ERR_NO_DATA) { // End of file
-			return_success(0);
-		} else if (code < 0) {
-			// Unexcepted error.
-			return_with_error(0, cgm_err_invalid_byte, no_errno);
-		} else if (code == cgm->unicode.element_start) {
-			printf("start\n");
-		} else if (code == cgm->unicode.element_end) {
-			printf("end\n");
-		} else if (code == cgm->unicode.escape) {
-			printf("escape\n");
-		} else if (code == cgm->unicode.inline_separator) {
-			printf("inline\n");
-		} else if (code == cgm->unicode.newline) {
-			printf("newline\n");
-			return_success(0);
-		} else if (code == cgm->unicode.tab) {
-			printf("tab\n");
-		} else if (code == cgm->unicode.space) {
-			printf("space\n");
-		} else {
-			printf("U+%x\n", code);
+	struct mmap_info in = mmap_fopen(in_file, mmap_mode_readonly);
+	if (in.state == mmap_state_error)
+		err(1, "Can not open %s for reading", in_file);
+
+	// File name is in the output, so it is part of the key.
+	const char *path = options->path != NULL ? options->path : "";
+	size_t key_len = strlen(format) + strlen(path) + strlen(in_file) + 16;
+	char *key_str = malloc(key_len);
+	if (key_str == NULL) err(1, "Can not allocate cache key");
+	snprintf(key_str, key_len, "%d %s %s %s", cache_version, format, path,
+		 in_file);
+	uint64_t key = cgm_cache_key(in.data, in.length, key_str);
+	free(key_str);
+
+	if (fflush(out) == EOF) err(1, "Can not write output");
+	int hit = cgm_cache_fetch(cache_dir, key, fileno(out));
+	if (hit == -1) err(1, "Can not read cache in %s", cache_dir);
+
+	if (!hit) {
+		char tmp_path[PATH_MAX];
+		int fd = cgm_cache_create(cache_dir, tmp_path);
+		if (fd == -1) err(1, "Can not create cache entry in %s",
+				  cache_dir);
+		FILE *tmp = fdopen(fd, "w+b");
+		if (tmp == NULL) {
+			unlink(tmp_path);
+			err(1, "Can not open %s", tmp_path);
 		}
-	}
-}
 
-/**
- * This function reads content until next character is non-text like element
- * boundary, escape character or newline. This function returns text block
- * length IN BYTES. At the end of this call cgm->p points to the start of the
- * next non-text character.
- * FIXME. Now it just takes everything it gets except newlines.
- */
-int cgm_read_text(struct cgm_info *cgm)
-{
-	const unsigned char *start = cgm->p;
-	unsigned char *p = cgm->p; // Current position in file.
-
-	while (1) {
-		int code = utf8_to_unicode(&p, cgm->endptr);
-		
-		if (code == UTF8_ERR_NO_DATA ||
-		    code == cgm->unicode.newline ) {
-			// End has came
-			int length = cgm->p - start;
-			return_success(length);
-		} else if (code < 0) {
-			// Unexcepted error.
-			return_with_error(0, cgm_err_invalid_byte, no_errno);
+		struct cgm_emitter emitter = open_emitter(format, tmp,
+							  streaming);
+		if (index != NULL) emitter = open_index(index, &emitter);
+		cgm_parse_buffer(in.data, in.length, in_file, options,
+				 &emitter);
+		if (cgm_error.code) {
+			unlink(tmp_path);
+			cgm_err(1, in_file);
 		}
-		cgm->p = p; // Keeping cgm->p always one char before p.
-	}
-}
 
-struct cgm_element cgm_read_element_name(struct cgm_info *cgm)
-{
-	struct cgm_element element;
-	
-	element.name = cgm->p; // Starting point
-	unsigned char *p = cgm->p; // Current position in file.
-
-	while (1) {
-		int code = utf8_to_unicode(&p, cgm->endptr);
-		
-		if (code == UTF8_ERR_NO_DATA ||
-		    code == cgm->unicode.newline ) {
-			// Sudden end of line
-			return_with_error(element, cgm_err_element, no_errno);
-		} else if (code < 0) {
-			// Unexcepted error.
-			return_with_error(element, cgm_err_invalid_byte,
-					  no_errno);
-		} else if (code == cgm->unicode.element_end) {
-			element.name_length = cgm->p - element.name;
-			element.is_inline = 0;
-			return_success(element);
-		} else if (code == cgm->unicode.inline_separator) {
-			element.name_length = cgm->p - element.name;
-			element.is_inline = 1;
-			return_success(element);
+		if (emitter.close(emitter.data) == -1) {
+			unlink(tmp_path);
+			if (cgm_memory_exceeded())
+				errx(1, "Memory limit exceeded while writing "
+				     "%s", tmp_path);
+			err(1, "Can not write to %s", tmp_path);
 		}
-		cgm->p = p; // Keeping cgm->p always one char before p.
-	}
-}
 
+		if (cgm_cache_copy(fd, fileno(out), ftello(tmp)) == -1) {
+			unlink(tmp_path);
+			err(1, "Can not write output");
+		}
+		if (fclose(tmp) == EOF) {
+			unlink(tmp_path);
+			err(1, "Can not write to %s", tmp_path);
+		}
 
-int cgm_is_this(struct cgm_info *cgm, int charcode)
-{
-	unsigned char *p = cgm->p; // Current position in file.
-	int code = utf8_to_unicode(&p, cgm->endptr);
-		
-	if (code == UTF8_ERR_NO_DATA) {
-	  // End of file
-	  return_success(0);
-	} else if (code < 0) {
-	  // Unexcepted error.
-	  return_with_error(0, cgm_err_invalid_byte, no_errno);
-	} else if (code == charcode) {
-	  // Found. Go forward in the stream
-	  cgm->p = p;
-	  return_success(1);
+		if (cgm_cache_store(cache_dir, key, tmp_path,
+				    cache_limit) == -1)
+			warn("Can not store cache entry in %s", cache_dir);
 	}
 
-	return_success(0);
+	mmap_close(&in);
+	return hit;
 }
 
 #else
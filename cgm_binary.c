@@ -0,0 +1,172 @@
+/**
+ * Compact binary output backend of the CGM parser. Every event is written
+ * as a record of tag byte and an optional length-prefixed payload. See
+ * cgm_emitter.h for the format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgm_emitter.h"
+
+/**
+ * Writes a record with a payload. Length is written as 32-bit big-endian.
+ */
+static void binary_write_record(FILE *out, enum cgm_binary_tag tag,
+				const unsigned char *payload, int length)
+{
+	unsigned char head[5];
+	unsigned long len = length;
+
+	head[0] = tag;
+	head[1] = (len >> 24) & 0xff;
+	head[2] = (len >> 16) & 0xff;
+	head[3] = (len >> 8) & 0xff;
+	head[4] = len & 0xff;
+
+	fwrite(head, 1, sizeof(head), out);
+	fwrite(payload, 1, length, out);
+}
+
+struct binary_emitter {
+	FILE *out;
+	int names;     // number of names defined in the output
+	int *ids;      // output ID + 1 by symbol ID, 0 if not defined yet
+	int ids_alloc; // allocated size of ids
+	int failed;    // out of memory, output is incomplete
+};
+
+/**
+ * Returns the output ID of given symbol ID, writing the name definition
+ * first if the symbol has none yet. Symbol IDs may come in any order, eg.
+ * "block" has ID 0 but may never appear, so output IDs are numbered
+ * separately in the order of definitions. Returns -1 if out of memory.
+ */
+static int binary_name(struct binary_emitter *bin, int id,
+		       const unsigned char *name, int name_length)
+{
+	if (id >= bin->ids_alloc) {
+		int alloc = bin->ids_alloc ? 2 * bin->ids_alloc : 16;
+		while (alloc <= id) alloc *= 2;
+
+		int *p = realloc(bin->ids, alloc * sizeof(*p));
+		if (p == NULL) return -1;
+		memset(p + bin->ids_alloc, 0,
+		       (alloc - bin->ids_alloc) * sizeof(*p));
+		bin->ids = p;
+		bin->ids_alloc = alloc;
+	}
+
+	if (bin->ids[id] == 0) {
+		binary_write_record(bin->out, cgm_binary_name, name,
+				    name_length);
+		bin->ids[id] = ++bin->names;
+	}
+	return bin->ids[id] - 1;
+}
+
+static void binary_start_document(void *data, const char *original)
+{
+	struct binary_emitter *bin = data;
+
+	binary_write_record(bin->out, cgm_binary_start_document,
+			    (const unsigned char *)original, strlen(original));
+}
+
+static void binary_start_element(void *data, int id, const unsigned char *name,
+				 int name_length)
+{
+	struct binary_emitter *bin = data;
+	unsigned char head[5];
+
+	int out_id = binary_name(bin, id, name, name_length);
+	if (out_id == -1) {
+		// Output is unusable anyway, make close() report it.
+		bin->failed = 1;
+		return;
+	}
+	unsigned long n = out_id;
+
+	head[0] = cgm_binary_start_element;
+	head[1] = (n >> 24) & 0xff;
+	head[2] = (n >> 16) & 0xff;
+	head[3] = (n >> 8) & 0xff;
+	head[4] = n & 0xff;
+	fwrite(head, 1, sizeof(head), bin->out);
+}
+
+static void binary_text(void *data, const unsigned char *text, int length)
+{
+	struct binary_emitter *bin = data;
+
+	binary_write_record(bin->out, cgm_binary_text, text, length);
+}
+
+static void binary_end_element(void *data)
+{
+	struct binary_emitter *bin = data;
+
+	putc(cgm_binary_end_element, bin->out);
+}
+
+static void binary_end_document(void *data)
+{
+	struct binary_emitter *bin = data;
+
+	putc(cgm_binary_end_document, bin->out);
+
+	// Next document has its own names.
+	bin->names = 0;
+	if (bin->ids != NULL)
+		memset(bin->ids, 0, bin->ids_alloc * sizeof(*bin->ids));
+}
+
+static int binary_close(void *data)
+{
+	struct binary_emitter *bin = data;
+	int ret = 0;
+
+	if (fflush(bin->out) == EOF || ferror(bin->out) || bin->failed)
+		ret = -1;
+
+	free(bin->ids);
+	free(bin);
+	return ret;
+}
+
+/**
+ * Opens an emitter which writes compact binary to out. The output starts
+ * with magic "CGMB" and version byte followed by records. Every record
+ * starts with a tag byte from enum cgm_binary_tag. Document start, name
+ * definition and text have a 32-bit big-endian byte length and the payload
+ * after the tag. Element start has a 32-bit big-endian name ID. Names get
+ * IDs from 0 upwards in the order of their definitions, and a name is
+ * always defined before the first element using it. In case of error,
+ * data is NULL.
+ */
+struct cgm_emitter cgm_binary_emitter(FILE *out)
+{
+	struct cgm_emitter emitter;
+	emitter.start_document = binary_start_document;
+	emitter.start_element = binary_start_element;
+	emitter.text = binary_text;
+	emitter.end_element = binary_end_element;
+	emitter.end_document = binary_end_document;
+	emitter.close = binary_close;
+	emitter.data = NULL; // Set if everything is ok.
+
+	struct binary_emitter *bin = malloc(sizeof(struct binary_emitter));
+	if (bin == NULL) return emitter;
+	bin->out = out;
+	bin->names = 0;
+	bin->ids = NULL;
+	bin->ids_alloc = 0;
+	bin->failed = 0;
+
+	fputs("CGMB", out);
+	putc(CGM_BINARY_VERSION, out);
+
+	emitter.data = bin;
+	return emitter;
+}
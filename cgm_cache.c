@@ -0,0 +1,321 @@
+/**
+ * On-disk cache of conversion results. See cgm_cache.h.
+ *
+ * The hash is XXH64 by Yann Collet. Words are read in host byte order, so
+ * keys differ between little and big-endian machines. That's fine because
+ * the cache is not meant to be shared between machines.
+ */
+
+#define _XOPEN_SOURCE 700 // for mkstemp(), futimens(), PATH_MAX
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "cgm_cache.h"
+
+static const time_t stale_tmp_age = 24 * 60 * 60; // seconds
+
+static const uint64_t prime_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime_3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime_5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * prime_2;
+	acc = rotl(acc, 31);
+	return acc * prime_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * prime_1 + prime_4;
+}
+
+static uint64_t xxh64(const void *data, size_t length, uint64_t seed)
+{
+	const unsigned char *p = data;
+	const unsigned char *end = p + length;
+	uint64_t h;
+
+	if (length >= 32) {
+		// Four lanes of 8 bytes at a time
+		uint64_t v1 = seed + prime_1 + prime_2;
+		uint64_t v2 = seed + prime_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - prime_1;
+
+		for (; p + 32 <= end; p += 32) {
+			v1 = xxh64_round(v1, read64(p));
+			v2 = xxh64_round(v2, read64(p + 8));
+			v3 = xxh64_round(v3, read64(p + 16));
+			v4 = xxh64_round(v4, read64(p + 24));
+		}
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = xxh64_merge(h, v1);
+		h = xxh64_merge(h, v2);
+		h = xxh64_merge(h, v3);
+		h = xxh64_merge(h, v4);
+	} else {
+		h = seed + prime_5;
+	}
+
+	h += length;
+
+	// The tail
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, read64(p));
+		h = rotl(h, 27) * prime_1 + prime_4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * prime_1;
+		h = rotl(h, 23) * prime_2 + prime_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * prime_5;
+		h = rotl(h, 11) * prime_1;
+	}
+
+	// Avalanche
+	h ^= h >> 33;
+	h *= prime_2;
+	h ^= h >> 29;
+	h *= prime_3;
+	h ^= h >> 32;
+	return h;
+}
+
+/**
+ * Calculates cache key of given input and options. Options is a string
+ * describing everything else which affects the output, like format and
+ * the name of the document.
+ */
+uint64_t cgm_cache_key(const void *data, size_t length, const char *options)
+{
+	return xxh64(data, length, xxh64(options, strlen(options), 0));
+}
+
+/**
+ * Writes the path of the cache entry to path (PATH_MAX bytes).
+ */
+static void cgm_cache_path(char *path, const char *dir, uint64_t key)
+{
+	snprintf(path, PATH_MAX, "%s/%016llx", dir, (unsigned long long)key);
+}
+
+/**
+ * Copies length bytes from the beginning of in_fd to out_fd. Uses
+ * sendfile(2) when possible so the data doesn't go through user space.
+ * Returns 0 on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_cache_copy(int in_fd, int out_fd, off_t length)
+{
+	off_t offset = 0;
+
+	while (offset < length) {
+		ssize_t n = sendfile(out_fd, in_fd, &offset, length - offset);
+		if (n > 0) continue;
+		if (n == 0) {
+			errno = EIO; // File was truncated under us.
+			return -1;
+		}
+		if (errno == EINTR) continue;
+		if (errno == EINVAL || errno == ENOSYS) break;
+		return -1;
+	}
+
+	// Falling back to plain read and write.
+	char buf[65536];
+	while (offset < length) {
+		ssize_t n = pread(in_fd, buf, sizeof(buf), offset);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) {
+			if (n == 0) errno = EIO;
+			return -1;
+		}
+		for (ssize_t done = 0; done < n;) {
+			ssize_t w = write(out_fd, buf + done, n - done);
+			if (w == -1) {
+				if (errno == EINTR) continue;
+				return -1;
+			}
+			done += w;
+		}
+		offset += n;
+	}
+
+	return 0;
+}
+
+/**
+ * Copies the cache entry of given key to out_fd and marks it used.
+ * Returns 1 if found, 0 if not found and -1 on error. Errno is set in case
+ * of error.
+ */
+int cgm_cache_fetch(const char *dir, uint64_t key, int out_fd)
+{
+	char path[PATH_MAX];
+	cgm_cache_path(path, dir, key);
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return errno == ENOENT ? 0 : -1;
+
+	struct stat stats;
+	if (fstat(fd, &stats) == -1 ||
+	    cgm_cache_copy(fd, out_fd, stats.st_size) == -1) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+
+	// Modification time is the time of the last use.
+	futimens(fd, NULL);
+	close(fd);
+	return 1;
+}
+
+/**
+ * Creates a temporary file in the cache directory for a new entry. Path of
+ * the file is written to tmp_path which must have room for PATH_MAX bytes.
+ * Returns file descriptor of the file or -1 on error. Errno is set in case
+ * of error.
+ */
+int cgm_cache_create(const char *dir, char *tmp_path)
+{
+	snprintf(tmp_path, PATH_MAX, "%s/tmp.XXXXXX", dir);
+	return mkstemp(tmp_path);
+}
+
+struct cgm_cache_entry {
+	char name[17];  // 16 hex digits
+	struct timespec used;
+	off_t size;
+};
+
+static int cgm_cache_cmp_used(const void *a, const void *b)
+{
+	const struct cgm_cache_entry *x = a, *y = b;
+	if (x->used.tv_sec != y->used.tv_sec)
+		return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+	return (x->used.tv_nsec > y->used.tv_nsec) -
+		(x->used.tv_nsec < y->used.tv_nsec);
+}
+
+/**
+ * Removes least recently used entries until the cache is at most limit
+ * bytes. Temporary files not written for a day are left by writers which
+ * died, so they are removed too. Returns 0 on success and -1 on error.
+ */
+static int cgm_cache_evict(const char *dir, off_t limit)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL) return -1;
+
+	struct cgm_cache_entry *entries = NULL;
+	size_t count = 0, alloc = 0;
+	off_t total = 0;
+	struct dirent *ent;
+	char path[PATH_MAX];
+	time_t now = time(NULL);
+
+	while ((ent = readdir(d)) != NULL) {
+		struct stat stats;
+
+		// Temporary files of other writers, unless they are stale.
+		if (strncmp(ent->d_name, "tmp.", 4) == 0) {
+			snprintf(path, sizeof(path), "%s/%s", dir,
+				 ent->d_name);
+			if (stat(path, &stats) == 0 &&
+			    now - stats.st_mtime > stale_tmp_age)
+				unlink(path);
+			continue;
+		}
+
+		if (strlen(ent->d_name) != 16 ||
+		    strspn(ent->d_name, "0123456789abcdef") != 16) continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		if (stat(path, &stats) == -1) continue;
+
+		if (count == alloc) {
+			alloc = alloc ? 2 * alloc : 64;
+			struct cgm_cache_entry *p =
+				realloc(entries, alloc * sizeof(*entries));
+			if (p == NULL) {
+				free(entries);
+				closedir(d);
+				return -1;
+			}
+			entries = p;
+		}
+		strcpy(entries[count].name, ent->d_name);
+		entries[count].used = stats.st_mtim;
+		entries[count].size = stats.st_size;
+		total += stats.st_size;
+		count++;
+	}
+	closedir(d);
+
+	if (total > limit) {
+		qsort(entries, count, sizeof(*entries), cgm_cache_cmp_used);
+		for (size_t i = 0; i < count && total > limit; i++) {
+			snprintf(path, sizeof(path), "%s/%s", dir,
+				 entries[i].name);
+			if (unlink(path) == 0) total -= entries[i].size;
+		}
+	}
+
+	free(entries);
+	return 0;
+}
+
+/**
+ * Turns the temporary file to the cache entry of given key and removes
+ * least recently used entries until the cache is at most limit bytes, and
+ * stale temporary files. Returns 0 on success and -1 on error. Errno is set
+ * in case of error.
+ */
+int cgm_cache_store(const char *dir, uint64_t key, const char *tmp_path,
+		    off_t limit)
+{
+	char path[PATH_MAX];
+	cgm_cache_path(path, dir, key);
+
+	// Rename is atomic, so readers never see half-written entries.
+	if (rename(tmp_path, path) == -1) return -1;
+
+	return cgm_cache_evict(dir, limit);
+}
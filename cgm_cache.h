@@ -0,0 +1,54 @@
+#ifndef CGM_CACHE_H
+#define CGM_CACHE_H   1
+
+/**
+ * On-disk cache of conversion results. Entries are files in a cache
+ * directory named by a 64-bit hash of the input document and output
+ * options. Modification time of an entry is its last use and the least
+ * recently used entries are removed when the directory grows too large.
+ * Temporary files older than a day are removed at the same time.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Calculates cache key of given input and options. Options is a string
+ * describing everything else which affects the output, like format and
+ * the name of the document.
+ */
+uint64_t cgm_cache_key(const void *data, size_t length, const char *options);
+
+/**
+ * Copies the cache entry of given key to out_fd and marks it used.
+ * Returns 1 if found, 0 if not found and -1 on error. Errno is set in case
+ * of error.
+ */
+int cgm_cache_fetch(const char *dir, uint64_t key, int out_fd);
+
+/**
+ * Creates a temporary file in the cache directory for a new entry. Path of
+ * the file is written to tmp_path which must have room for PATH_MAX bytes.
+ * Returns file descriptor of the file or -1 on error. Errno is set in case
+ * of error.
+ */
+int cgm_cache_create(const char *dir, char *tmp_path);
+
+/**
+ * Turns the temporary file to the cache entry of given key and removes
+ * least recently used entries until the cache is at most limit bytes, and
+ * stale temporary files. Returns 0 on success and -1 on error. Errno is set
+ * in case of error.
+ */
+int cgm_cache_store(const char *dir, uint64_t key, const char *tmp_path,
+		    off_t limit);
+
+/**
+ * Copies length bytes from the beginning of in_fd to out_fd. Uses
+ * sendfile(2) when possible so the data doesn't go through user space.
+ * Returns 0 on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_cache_copy(int in_fd, int out_fd, off_t length);
+
+#endif /* cgm_cache.h */
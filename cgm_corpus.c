@@ -0,0 +1,247 @@
+/**
+ * Packed corpus of many CGM documents in one file. See cgm_corpus.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for fseeko()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cgm_corpus.h"
+
+static const size_t header_size = 24;
+static const size_t entry_size = 32;
+
+static uint64_t get64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < 8; i++) v = v << 8 | p[i];
+	return v;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | p[3];
+}
+
+static void set64(unsigned char *p, uint64_t v)
+{
+	for (int i = 7; i >= 0; i--, v >>= 8) p[i] = v;
+}
+
+static void set32(unsigned char *p, uint32_t v)
+{
+	for (int i = 3; i >= 0; i--, v >>= 8) p[i] = v;
+}
+
+/**
+ * Opens a corpus file. Returns 0 on success and -1 on error. Errno is set
+ * in case of error, to EINVAL if the file is not a valid corpus.
+ */
+int cgm_corpus_open(struct cgm_corpus *corpus, const char *filename)
+{
+	corpus->file = mmap_fopen(filename, mmap_mode_readonly);
+	if (corpus->file.state == mmap_state_error) return -1;
+
+	const unsigned char *p = corpus->file.data;
+	uint64_t size = corpus->file.length;
+
+	if (size < header_size || memcmp(p, "CGMP", 4) ||
+	    p[4] != CGM_CORPUS_VERSION) goto invalid;
+
+	corpus->count = get64(p + 8);
+	uint64_t directory = get64(p + 16);
+
+	// Whole directory must be in the file.
+	if (directory < header_size || directory > size ||
+	    corpus->count > (size - directory) / entry_size) goto invalid;
+	corpus->directory = p + directory;
+	return 0;
+invalid:
+	mmap_close(&corpus->file);
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Closes the corpus. Entries are not valid anymore.
+ */
+void cgm_corpus_close(struct cgm_corpus *corpus)
+{
+	mmap_close(&corpus->file);
+}
+
+/**
+ * Finds document of given index. Returns 0 on success and -1 with errno
+ * EINVAL if the index is out of range or the entry is corrupted.
+ */
+int cgm_corpus_get(const struct cgm_corpus *corpus, uint64_t index,
+		   struct cgm_corpus_entry *entry)
+{
+	const unsigned char *base = corpus->file.data;
+	uint64_t size = corpus->file.length;
+
+	if (index >= corpus->count) goto invalid;
+
+	const unsigned char *e = corpus->directory + index * entry_size;
+	uint64_t offset = get64(e);
+	uint64_t length = get64(e + 8);
+	uint64_t name = get64(e + 16);
+	uint32_t name_length = get32(e + 24);
+
+	// Nothing may point outside the file, and names end with NUL.
+	if (offset > size || length > size - offset || name >= size ||
+	    name_length >= size - name || base[name + name_length] != '\0')
+		goto invalid;
+
+	entry->data = base + offset;
+	entry->length = length;
+	entry->name = (const char *)base + name;
+	entry->flags = get32(e + 28);
+	return 0;
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Creates a corpus file of count documents. Documents may be put in any
+ * order. Documents not put are empty and flagged CGM_CORPUS_FAILED.
+ * Returns 0 on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_corpus_create(struct cgm_corpus_writer *writer, const char *filename,
+		      uint64_t count)
+{
+	if (count > SIZE_MAX / entry_size) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	writer->count = count;
+	writer->offset = header_size;
+	writer->directory = calloc(count ? count : 1, entry_size);
+	writer->names = calloc(count ? count : 1, sizeof(char *));
+	writer->out = NULL;
+	if (writer->directory == NULL || writer->names == NULL) goto fail;
+
+	writer->out = fopen(filename, "wb");
+	if (writer->out == NULL) goto fail;
+
+	// Header is written for real when the directory is ready.
+	unsigned char header[24] = { 0 };
+	if (fwrite(header, 1, header_size, writer->out) != header_size)
+		goto fail;
+	return 0;
+fail:
+	if (writer->out != NULL) fclose(writer->out);
+	free(writer->directory);
+	free(writer->names);
+	return -1;
+}
+
+/**
+ * Returns a malloc'd copy of the name if index is valid and not put yet.
+ * Returns NULL and sets errno otherwise.
+ */
+static char *cgm_corpus_name(struct cgm_corpus_writer *writer,
+			     uint64_t index, const char *name)
+{
+	if (index >= writer->count || writer->names[index] != NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	char *copy = malloc(strlen(name) + 1);
+	if (copy != NULL) strcpy(copy, name);
+	return copy;
+}
+
+/**
+ * Writes the document of given index. Every index may be put once.
+ * Returns 0 on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_corpus_put(struct cgm_corpus_writer *writer, uint64_t index,
+		   const char *name, const void *data, size_t length)
+{
+	char *copy = cgm_corpus_name(writer, index, name);
+	if (copy == NULL) return -1;
+
+	if (fwrite(data, 1, length, writer->out) != length) {
+		free(copy);
+		return -1;
+	}
+
+	unsigned char *e = writer->directory + index * entry_size;
+	set64(e, writer->offset);
+	set64(e + 8, length);
+	writer->names[index] = copy;
+	writer->offset += length;
+	return 0;
+}
+
+/**
+ * Marks the document of given index failed, so it has only the name and
+ * flag CGM_CORPUS_FAILED. Every index may be put or failed once. Returns 0
+ * on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_corpus_fail(struct cgm_corpus_writer *writer, uint64_t index,
+		    const char *name)
+{
+	char *copy = cgm_corpus_name(writer, index, name);
+	if (copy == NULL) return -1;
+
+	unsigned char *e = writer->directory + index * entry_size;
+	set64(e, header_size);
+	set32(e + 28, CGM_CORPUS_FAILED);
+	writer->names[index] = copy;
+	return 0;
+}
+
+/**
+ * Writes the directory and closes the file. Returns 0 on success and -1
+ * on error, also if writing any document failed. Errno is set in case of
+ * error.
+ */
+int cgm_corpus_finish(struct cgm_corpus_writer *writer)
+{
+	uint64_t directory = writer->offset;
+	uint64_t name = directory + writer->count * entry_size;
+
+	// Names go after the directory, empty ones for missing documents.
+	for (uint64_t i = 0; i < writer->count; i++) {
+		unsigned char *e = writer->directory + i * entry_size;
+		const char *n = writer->names[i] ? writer->names[i] : "";
+		size_t length = strlen(n);
+
+		if (writer->names[i] == NULL) {
+			set64(e, header_size);
+			set32(e + 28, CGM_CORPUS_FAILED);
+		}
+		set64(e + 16, name);
+		set32(e + 24, length);
+		name += length + 1;
+	}
+	fwrite(writer->directory, entry_size, writer->count, writer->out);
+
+	for (uint64_t i = 0; i < writer->count; i++) {
+		const char *n = writer->names[i] ? writer->names[i] : "";
+		fwrite(n, 1, strlen(n) + 1, writer->out);
+		free(writer->names[i]);
+	}
+	free(writer->names);
+	free(writer->directory);
+
+	unsigned char header[24] = { 'C', 'G', 'M', 'P', CGM_CORPUS_VERSION };
+	set64(header + 8, writer->count);
+	set64(header + 16, directory);
+
+	int ret = 0;
+	if (fseeko(writer->out, 0, SEEK_SET) == -1 ||
+	    fwrite(header, 1, header_size, writer->out) != header_size ||
+	    ferror(writer->out)) ret = -1;
+	if (fclose(writer->out) == EOF) ret = -1;
+	return ret;
+}
@@ -0,0 +1,96 @@
+#ifndef CGM_CORPUS_H
+#define CGM_CORPUS_H   1
+
+/**
+ * Packed corpus of many CGM documents in one file. The file is mapped once
+ * and documents are found from a directory of offsets and lengths, so
+ * reading a document needs no system calls at all.
+ *
+ * The format, all integers big-endian: magic "CGMP", version byte and
+ * three zero bytes, number of documents (64 bits) and offset of the
+ * directory (64 bits). Documents follow the header back to back. The
+ * directory has a 32-byte entry per document: offset, length and offset
+ * of the name (64 bits each), length of the name and flags (32 bits each).
+ * Names are NUL-terminated and stored after the directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "mmap.h"
+
+#define CGM_CORPUS_VERSION 1
+
+// Entry flags
+#define CGM_CORPUS_FAILED 1 // no document, eg. its conversion failed
+
+struct cgm_corpus {
+	struct mmap_info file;
+	uint64_t count;                  // number of documents
+	const unsigned char *directory;
+};
+
+struct cgm_corpus_entry {
+	const unsigned char *data;
+	size_t length;
+	const char *name;                // NUL-terminated
+	uint32_t flags;                  // CGM_CORPUS_* bits
+};
+
+struct cgm_corpus_writer {
+	FILE *out;
+	uint64_t count;
+	uint64_t offset;                 // where the next document goes
+	unsigned char *directory;        // count entries, names not included
+	char **names;                    // malloc'd names by index
+};
+
+/**
+ * Opens a corpus file. Returns 0 on success and -1 on error. Errno is set
+ * in case of error, to EINVAL if the file is not a valid corpus.
+ */
+int cgm_corpus_open(struct cgm_corpus *corpus, const char *filename);
+
+/**
+ * Closes the corpus. Entries are not valid anymore.
+ */
+void cgm_corpus_close(struct cgm_corpus *corpus);
+
+/**
+ * Finds document of given index. Returns 0 on success and -1 with errno
+ * EINVAL if the index is out of range or the entry is corrupted.
+ */
+int cgm_corpus_get(const struct cgm_corpus *corpus, uint64_t index,
+		   struct cgm_corpus_entry *entry);
+
+/**
+ * Creates a corpus file of count documents. Documents may be put in any
+ * order. Documents not put are empty and flagged CGM_CORPUS_FAILED.
+ * Returns 0 on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_corpus_create(struct cgm_corpus_writer *writer, const char *filename,
+		      uint64_t count);
+
+/**
+ * Writes the document of given index. Every index may be put once.
+ * Returns 0 on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_corpus_put(struct cgm_corpus_writer *writer, uint64_t index,
+		   const char *name, const void *data, size_t length);
+
+/**
+ * Marks the document of given index failed, so it has only the name and
+ * flag CGM_CORPUS_FAILED. Every index may be put or failed once. Returns 0
+ * on success and -1 on error. Errno is set in case of error.
+ */
+int cgm_corpus_fail(struct cgm_corpus_writer *writer, uint64_t index,
+		    const char *name);
+
+/**
+ * Writes the directory and closes the file. Returns 0 on success and -1
+ * on error, also if writing any document failed. Errno is set in case of
+ * error.
+ */
+int cgm_corpus_finish(struct cgm_corpus_writer *writer);
+
+#endif /* cgm_corpus.h */
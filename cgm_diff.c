@@ -0,0 +1,492 @@
+/**
+ * Structural diff of CGM documents. See cgm_diff.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cgm_error.h"
+#include "cgm_diff.h"
+
+/**
+ * Initializes an empty tree. Returns 0 on success and -1 if out of memory.
+ */
+int cgm_tree_init(struct cgm_tree *tree)
+{
+	tree->nodes = NULL;
+	tree->count = 0;
+	tree->alloc = 0;
+	return cgm_symbols_init(&tree->names);
+}
+
+/**
+ * Frees the memory of the tree.
+ */
+void cgm_tree_free(struct cgm_tree *tree)
+{
+	free(tree->nodes);
+	cgm_symbols_free(&tree->names);
+	tree->nodes = NULL;
+	tree->count = 0;
+	tree->alloc = 0;
+}
+
+/**
+ * Order-dependent combination of two hashes, the round of XXH64.
+ */
+static uint64_t mix(uint64_t acc, uint64_t value)
+{
+	acc ^= value * 0x9E3779B185EBCA87ULL;
+	acc = acc << 31 | acc >> 33;
+	return acc * 0xC2B2AE3D27D4EB4FULL;
+}
+
+/**
+ * Continues FNV-1a hash with more bytes. Text may come in many calls and
+ * this gives the same hash regardless of how it is split.
+ */
+static uint64_t fnv(uint64_t hash, const unsigned char *data, int length)
+{
+	for (int i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+struct tree_emitter {
+	struct cgm_tree *tree;
+	uint32_t *open;    // ordinals of elements not ended yet
+	int open_count;
+	int open_alloc;
+	int failed;        // out of memory
+};
+
+/**
+ * Adds a node and makes it the current one. Returns -1 if out of memory.
+ */
+static int tree_push(struct tree_emitter *te, uint64_t own, int name)
+{
+	struct cgm_tree *tree = te->tree;
+
+	if (tree->count == tree->alloc) {
+		uint32_t alloc = tree->alloc ? 2 * tree->alloc : 256;
+		struct cgm_tree_node *p = realloc(tree->nodes,
+						  alloc * sizeof(*p));
+		if (p == NULL) return -1;
+		tree->nodes = p;
+		tree->alloc = alloc;
+	}
+	if (te->open_count == te->open_alloc) {
+		int alloc = te->open_alloc ? 2 * te->open_alloc : 16;
+		uint32_t *p = realloc(te->open, alloc * sizeof(*p));
+		if (p == NULL) return -1;
+		te->open = p;
+		te->open_alloc = alloc;
+	}
+
+	struct cgm_tree_node *node = &tree->nodes[tree->count];
+	node->own = own;
+	node->hash = 0; // Hash of the children until the node ends.
+	node->last = tree->count;
+	node->name = name;
+	node->line = cgm_error.line;
+	te->open[te->open_count++] = tree->count++;
+	return 0;
+}
+
+/**
+ * Ends the current node. Its hash is complete because all its children
+ * are, and it is added to the hash of the parent.
+ */
+static void tree_pop(struct tree_emitter *te)
+{
+	struct cgm_tree *tree = te->tree;
+	uint32_t ordinal = te->open[--te->open_count];
+	struct cgm_tree_node *node = &tree->nodes[ordinal];
+
+	node->last = tree->count - 1;
+	node->hash = mix(mix(node->own, node->hash), node->last - ordinal);
+
+	if (te->open_count) {
+		struct cgm_tree_node *parent =
+			&tree->nodes[te->open[te->open_count - 1]];
+		parent->hash = mix(parent->hash, node->hash);
+	}
+}
+
+static void tree_start_document(void *data, const char *original)
+{
+	struct tree_emitter *te = data;
+	(void)original; // Renamed files are still equal.
+
+	if (tree_push(te, 0, -1) == -1) te->failed = 1;
+}
+
+static void tree_start_element(void *data, int id, const unsigned char *name,
+			       int name_length)
+{
+	struct tree_emitter *te = data;
+	(void)id; // IDs of two documents don't match.
+
+	if (te->failed) return;
+
+	int own_id = cgm_symbols_intern(&te->tree->names, name, name_length);
+	if (own_id == -1) goto fail;
+
+	// Length separates the name from the text.
+	uint64_t own = mix(fnv(14695981039346656037ULL, name, name_length),
+			   name_length);
+	if (tree_push(te, own, own_id) == -1) goto fail;
+	return;
+fail:
+	te->failed = 1;
+}
+
+static void tree_text(void *data, const unsigned char *text, int length)
+{
+	struct tree_emitter *te = data;
+
+	if (te->failed) return;
+
+	struct cgm_tree_node *node =
+		&te->tree->nodes[te->open[te->open_count - 1]];
+	node->own = fnv(node->own, text, length);
+}
+
+static void tree_end_element(void *data)
+{
+	struct tree_emitter *te = data;
+
+	if (!te->failed) tree_pop(te);
+}
+
+static void tree_end_document(void *data)
+{
+	struct tree_emitter *te = data;
+
+	if (!te->failed) tree_pop(te);
+}
+
+static int tree_close(void *data)
+{
+	struct tree_emitter *te = data;
+	int ret = 0;
+
+	if (te->failed) {
+		errno = ENOMEM;
+		ret = -1;
+	}
+	free(te->open);
+	free(te);
+	return ret;
+}
+
+/**
+ * Opens an emitter which fills an empty tree with the hashes and lines of
+ * the parsed document. Lines are taken from cgm_error.line, so the emitter
+ * must be used with the parser directly. Closing the emitter returns -1
+ * with errno ENOMEM if the tree is incomplete. In case of error, data is
+ * NULL.
+ */
+struct cgm_emitter cgm_tree_emitter(struct cgm_tree *tree)
+{
+	struct cgm_emitter emitter;
+	emitter.start_document = tree_start_document;
+	emitter.start_element = tree_start_element;
+	emitter.text = tree_text;
+	emitter.end_element = tree_end_element;
+	emitter.end_document = tree_end_document;
+	emitter.close = tree_close;
+	emitter.data = NULL; // Set if everything is ok.
+
+	struct tree_emitter *te = malloc(sizeof(struct tree_emitter));
+	if (te == NULL) return emitter;
+	te->tree = tree;
+	te->open = NULL;
+	te->open_count = 0;
+	te->open_alloc = 0;
+	te->failed = 0;
+
+	emitter.data = te;
+	return emitter;
+}
+
+struct diff {
+	const struct cgm_tree *old;
+	const struct cgm_tree *new;
+	FILE *out;
+	int changes;
+};
+
+// Element whose children are being compared, for printing the path.
+struct diff_path {
+	const struct diff_path *up;
+	uint32_t node;     // in the old tree
+	uint32_t new_node; // in the new tree
+};
+
+// Children of the new element by hash, for finding where the lists meet
+// again after a change.
+struct diff_table {
+	uint64_t *keys;
+	uint32_t *heads; // first position with the hash + 1, 0 if free
+	uint32_t *next;  // next position with the same hash + 1, 0 if none
+	uint32_t mask;
+};
+
+/**
+ * Returns line of the last descendant of the node.
+ */
+static int last_line(const struct cgm_tree *tree, uint32_t node)
+{
+	return tree->nodes[tree->nodes[node].last].line;
+}
+
+static void diff_print_range(FILE *out, int first, int last)
+{
+	if (first == last) fprintf(out, "%d", first);
+	else fprintf(out, "%d,%d", first, last);
+}
+
+static void diff_print_path(const struct diff *d, const struct diff_path *path)
+{
+	if (path == NULL || d->old->nodes[path->node].name == -1) return;
+
+	diff_print_path(d, path->up);
+	if (path->up != NULL && d->old->nodes[path->up->node].name != -1)
+		putc('/', d->out);
+	const struct cgm_symbol *sym =
+		&d->old->names.symbols[d->old->nodes[path->node].name];
+	fwrite(sym->name, 1, sym->length, d->out);
+}
+
+/**
+ * Writes one change. Empty range is given as the line it comes after.
+ */
+static void diff_report(struct diff *d, int old_first, int old_last,
+			int new_first, int new_last, char op,
+			const struct diff_path *path)
+{
+	diff_print_range(d->out, old_first, old_last);
+	putc(op, d->out);
+	diff_print_range(d->out, new_first, new_last);
+	if (path != NULL && d->old->nodes[path->node].name != -1) {
+		putc(' ', d->out);
+		diff_print_path(d, path);
+	}
+	putc('\n', d->out);
+	d->changes++;
+}
+
+/**
+ * Collects the children of the node. Returns NULL if out of memory.
+ */
+static uint32_t *diff_children(const struct cgm_tree *tree, uint32_t node,
+			       uint32_t *count)
+{
+	uint32_t n = 0;
+	for (uint32_t c = node + 1; c <= tree->nodes[node].last;
+	     c = tree->nodes[c].last + 1) n++;
+
+	uint32_t *children = malloc((n ? n : 1) * sizeof(uint32_t));
+	if (children == NULL) return NULL;
+
+	n = 0;
+	for (uint32_t c = node + 1; c <= tree->nodes[node].last;
+	     c = tree->nodes[c].last + 1) children[n++] = c;
+	*count = n;
+	return children;
+}
+
+static int diff_same_name(const struct diff *d, uint32_t a, uint32_t b)
+{
+	const struct cgm_symbol *x =
+		&d->old->names.symbols[d->old->nodes[a].name];
+	const struct cgm_symbol *y =
+		&d->new->names.symbols[d->new->nodes[b].name];
+	return x->hash == y->hash && x->length == y->length &&
+		memcmp(x->name, y->name, x->length) == 0;
+}
+
+/**
+ * Fills the table with hashes of children[first..end) of the new tree.
+ * Returns -1 if out of memory.
+ */
+static int diff_table_init(struct diff_table *t, const struct cgm_tree *tree,
+			   const uint32_t *children, uint32_t first,
+			   uint32_t end)
+{
+	uint32_t size = 16;
+	while (size < 2 * (end - first)) size *= 2;
+
+	t->mask = size - 1;
+	t->keys = malloc(size * sizeof(uint64_t));
+	t->heads = calloc(size, sizeof(uint32_t));
+	t->next = malloc((end ? end : 1) * sizeof(uint32_t));
+	if (t->keys == NULL || t->heads == NULL || t->next == NULL) return -1;
+
+	// Backwards, so positions with the same hash are in ascending order.
+	for (uint32_t pos = end; pos-- > first;) {
+		uint64_t hash = tree->nodes[children[pos]].hash;
+		uint32_t i = hash & t->mask;
+		while (t->heads[i] && t->keys[i] != hash) i = (i + 1) & t->mask;
+
+		t->keys[i] = hash;
+		t->next[pos] = t->heads[i];
+		t->heads[i] = pos + 1;
+	}
+	return 0;
+}
+
+/**
+ * Returns the first position at or after 'from' having the hash, or -1.
+ * Positions before 'from' are never asked again, so they are dropped.
+ */
+static int64_t diff_table_find(struct diff_table *t, uint64_t hash,
+			       uint32_t from)
+{
+	uint32_t i = hash & t->mask;
+	while (t->heads[i] && t->keys[i] != hash) i = (i + 1) & t->mask;
+
+	while (t->heads[i] && t->heads[i] - 1 < from)
+		t->heads[i] = t->next[t->heads[i] - 1];
+	return (int64_t)t->heads[i] - 1;
+}
+
+static void diff_table_free(struct diff_table *t)
+{
+	free(t->keys);
+	free(t->heads);
+	free(t->next);
+}
+
+static int diff_node(struct diff *d, uint32_t a, uint32_t b,
+		     const struct diff_path *path);
+
+/**
+ * Compares children old[i..k) with new[j..p) which have no equal subtrees
+ * in common. Elements changed in place, having the same name at the same
+ * position, are compared recursively and the rest is reported as a whole.
+ * Returns -1 if out of memory.
+ */
+static int diff_region(struct diff *d, const uint32_t *old, uint32_t i,
+		       uint32_t k, const uint32_t *new, uint32_t j, uint32_t p,
+		       const struct diff_path *parent)
+{
+	for (; i < k && j < p && diff_same_name(d, old[i], new[j]); i++, j++)
+		if (diff_node(d, old[i], new[j], parent) == -1) return -1;
+
+	// Empty range is the line before it.
+	int old_before = i ? last_line(d->old, old[i-1]) :
+		d->old->nodes[parent->node].line;
+	int new_before = j ? last_line(d->new, new[j-1]) :
+		d->new->nodes[parent->new_node].line;
+
+	if (i == k && j == p) return 0;
+	if (i == k)
+		diff_report(d, old_before, old_before, d->new->nodes[new[j]].line,
+			    last_line(d->new, new[p-1]), 'a', parent);
+	else if (j == p)
+		diff_report(d, d->old->nodes[old[i]].line,
+			    last_line(d->old, old[k-1]), new_before,
+			    new_before, 'd', parent);
+	else
+		diff_report(d, d->old->nodes[old[i]].line,
+			    last_line(d->old, old[k-1]),
+			    d->new->nodes[new[j]].line,
+			    last_line(d->new, new[p-1]), 'c', parent);
+	return 0;
+}
+
+/**
+ * Compares two nodes with the same name but different hashes. Returns -1
+ * if out of memory.
+ */
+static int diff_node(struct diff *d, uint32_t a, uint32_t b,
+		     const struct diff_path *path)
+{
+	const struct cgm_tree_node *x = &d->old->nodes[a];
+	const struct cgm_tree_node *y = &d->new->nodes[b];
+
+	if (x->own != y->own)
+		diff_report(d, x->line, x->line, y->line, y->line, 'c', path);
+	if (x->last == a && y->last == b) return 0; // no children
+
+	uint32_t na, nb;
+	uint32_t *old = diff_children(d->old, a, &na);
+	uint32_t *new = old ? diff_children(d->new, b, &nb) : NULL;
+	if (new == NULL) {
+		free(old);
+		return -1;
+	}
+
+	struct diff_path here = { path, a, b };
+	struct diff_table table = { NULL, NULL, NULL, 0 };
+	int ret = 0;
+
+	// Common beginning and end are skipped one subtree at a time.
+	uint32_t i = 0, j = 0;
+	while (i < na && j < nb && d->old->nodes[old[i]].hash ==
+	       d->new->nodes[new[j]].hash) i++, j++;
+	while (na > i && nb > j && d->old->nodes[old[na-1]].hash ==
+	       d->new->nodes[new[nb-1]].hash) na--, nb--;
+
+	if (na - i <= 1 && nb - j <= 1) {
+		ret = diff_region(d, old, i, na, new, j, nb, &here);
+		goto out;
+	}
+
+	if (diff_table_init(&table, d->new, new, j, nb) == -1) {
+		ret = -1;
+		goto out;
+	}
+
+	while ((i < na || j < nb) && ret == 0) {
+		if (i < na && j < nb && d->old->nodes[old[i]].hash ==
+		    d->new->nodes[new[j]].hash) {
+			i++, j++;
+			continue;
+		}
+
+		// Next old child which is found later in the new list
+		uint32_t k = i;
+		int64_t p = nb;
+		for (; k < na; k++) {
+			int64_t found = diff_table_find(
+				&table, d->old->nodes[old[k]].hash, j);
+			if (found != -1) {
+				p = found;
+				break;
+			}
+		}
+
+		ret = diff_region(d, old, i, k, new, j, p, &here);
+		i = k;
+		j = p;
+	}
+out:
+	diff_table_free(&table);
+	free(old);
+	free(new);
+	return ret;
+}
+
+/**
+ * Compares two trees and writes the changed blocks to out in the style of
+ * diff(1) without the contents, eg. "12,15c12,16", followed by the path of
+ * the parent element. Returns number of changes or -1 if out of memory.
+ */
+int cgm_diff(const struct cgm_tree *old, const struct cgm_tree *new,
+	     FILE *out)
+{
+	struct diff d = { old, new, out, 0 };
+
+	if (old->count == 0 || new->count == 0 ||
+	    old->nodes[0].hash == new->nodes[0].hash) return 0;
+
+	if (diff_node(&d, 0, 0, NULL) == -1) return -1;
+	return d.changes;
+}
@@ -0,0 +1,58 @@
+#ifndef CGM_DIFF_H
+#define CGM_DIFF_H   1
+
+/**
+ * Structural diff of CGM documents. Every subtree gets a hash of its name,
+ * text and the hashes of its children while parsing, so identical subtrees
+ * are skipped by comparing one number. Only the changed blocks are walked
+ * and reported with their line ranges.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cgm_emitter.h"
+#include "cgm_symbols.h"
+
+struct cgm_tree_node {
+	uint64_t hash; // name, text and children
+	uint64_t own;  // name and text only
+	uint32_t last; // ordinal of the last descendant (or itself)
+	int name;      // ID in the names of the tree, -1 for the document
+	int line;      // line of the element in the source
+};
+
+struct cgm_tree {
+	struct cgm_symbols names;     // tree's own name IDs
+	struct cgm_tree_node *nodes;  // in document order, document first
+	uint32_t count;
+	uint32_t alloc;
+};
+
+/**
+ * Initializes an empty tree. Returns 0 on success and -1 if out of memory.
+ */
+int cgm_tree_init(struct cgm_tree *tree);
+
+/**
+ * Frees the memory of the tree.
+ */
+void cgm_tree_free(struct cgm_tree *tree);
+
+/**
+ * Opens an emitter which fills an empty tree with the hashes and lines of
+ * the parsed document. Lines are taken from cgm_error.line, so the emitter
+ * must be used with the parser directly. Closing the emitter returns -1
+ * with errno ENOMEM if the tree is incomplete. In case of error, data is
+ * NULL.
+ */
+struct cgm_emitter cgm_tree_emitter(struct cgm_tree *tree);
+
+/**
+ * Compares two trees and writes the changed blocks to out in the style of
+ * diff(1) without the contents, eg. "12,15c12,16", followed by the path of
+ * the parent element. Returns number of changes or -1 if out of memory.
+ */
+int cgm_diff(const struct cgm_tree *old, const struct cgm_tree *new,
+	     FILE *out);
+
+#endif /* cgm_diff.h */
@@ -0,0 +1,79 @@
+#ifndef CGM_EMITTER_H
+#define CGM_EMITTER_H   1
+
+#include <stdio.h>
+
+/**
+ * Output backends of the CGM parser. The parser calls these functions while
+ * it reads the file and every backend writes its own format directly from
+ * the parsed spans. Spans point to the input buffer and are valid only
+ * during the call, so copy them if you need them later.
+ */
+
+struct cgm_emitter {
+	void *data; // State of the backend, NULL if opening failed.
+
+	// Called once before anything else. 'original' is the file name.
+	void (*start_document)(void *data, const char *original);
+
+	// Element start. Every distinct name has its own ID, starting from 0
+	// in the order of appearance, so emitters may compare and index IDs
+	// instead of names. The name is NUL-terminated and stays valid until
+	// end_document() returns.
+	void (*start_element)(void *data, int id, const unsigned char *name,
+			      int name_length);
+
+	// Text inside the current element. Not NUL-terminated.
+	void (*text)(void *data, const unsigned char *text, int length);
+
+	// Ends the element started last.
+	void (*end_element)(void *data);
+
+	// Called once after everything else.
+	void (*end_document)(void *data);
+
+	// Flushes the output and frees the backend. The output file is not
+	// closed. Returns 0 on success and -1 on write error.
+	int (*close)(void *data);
+};
+
+/**
+ * Opens an emitter which builds libxml2 DOM tree and writes it as XML to
+ * out. If streaming is non-zero, every top-level element is written and
+ * freed as soon as it is complete so only one of them is in memory at a
+ * time. In case of error, data is NULL.
+ */
+struct cgm_emitter cgm_xml_emitter(FILE *out, int streaming);
+
+/**
+ * Opens an emitter which writes JSON to out. Elements are objects
+ * {"name": "...", "children": [...]} and text is strings. Document is an
+ * object {"original": "...", "children": [...]}. In case of error, data is
+ * NULL.
+ */
+struct cgm_emitter cgm_json_emitter(FILE *out);
+
+/**
+ * Opens an emitter which writes compact binary to out. The output starts
+ * with magic "CGMB" and version byte followed by records. Every record
+ * starts with a tag byte from enum cgm_binary_tag. Document start, name
+ * definition and text have a 32-bit big-endian byte length and the payload
+ * after the tag. Element start has a 32-bit big-endian name ID. Names get
+ * IDs from 0 upwards in the order of their definitions, and a name is
+ * always defined before the first element using it. In case of error,
+ * data is NULL.
+ */
+struct cgm_emitter cgm_binary_emitter(FILE *out);
+
+#define CGM_BINARY_VERSION 2
+
+enum cgm_binary_tag {
+	cgm_binary_start_document = 'D', // payload: original file name
+	cgm_binary_name = 'N',           // payload: element name
+	cgm_binary_start_element = 'E',  // name ID, no payload
+	cgm_binary_text = 'T',           // payload: text
+	cgm_binary_end_element = 'e',    // no payload
+	cgm_binary_end_document = 'd'    // no payload
+};
+
+#endif /* cgm_emitter.h */
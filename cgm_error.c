@@ -6,13 +6,12 @@
 #include <err.h>
 #include "cgm_error.h"
 
-struct cgm_error_struct cgm_error;
+__thread struct cgm_error_struct cgm_error;
 
 /**
- * Displays error with CGM parsing in a user friendly form. Exits the program
- * with retval and puts file name 'file' to the error message.
+ * Returns a message describing the current error in cgm_error.
  */
-void cgm_err(int retval, const char *file)
+const char *cgm_strerror(void)
 {
 	static const char *msgs[] = {
 		/* cgm_err_no_error */ "No error",
@@ -21,13 +20,29 @@ void cgm_err(int retval, const char *file)
 		/* cgm_err_invalid_header */ "Invalid header. Not a CGM file?",
 		/* cgm_err_garbage */ "Garbage on line",
 		/* cgm_err_invalid_byte */ "Invalid encoding in file",
-		/* cgm_err_indentation */ "Obscure indentation"
+		/* cgm_err_indentation */ "Obscure indentation",
+		/* cgm_err_element */ "Unterminated element",
+		/* cgm_err_too_deep */ "Too deep indentation",
+		/* cgm_err_memory */ "Out of memory",
+		/* cgm_err_compressed */ "Corrupted compressed data",
+		/* cgm_err_escape */ "Escape character at the end of line",
+		/* cgm_err_memory_limit */ "Memory limit exceeded",
+		/* cgm_err_decompressed_limit */ "Decompressed data too large"
 	};
-	
+
+	return msgs[cgm_error.code];
+}
+
+/**
+ * Displays error with CGM parsing in a user friendly form. Exits the program
+ * with retval and puts file name 'file' to the error message.
+ */
+void cgm_err(int retval, const char *file)
+{
 	if ( cgm_error.see_errno)
 		err(retval, "At file %s:%d: %s", file, cgm_error.line,
-		    msgs[cgm_error.code]);
+		    cgm_strerror());
 	else
 		errx(retval, "At file %s:%d: %s", file, cgm_error.line,
-		    msgs[cgm_error.code]);
+		    cgm_strerror());
 }
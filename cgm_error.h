@@ -6,6 +6,8 @@
  * library.
  */
 
+#include <stddef.h>
+
 #define has_errno 1
 #define no_errno 0
 
@@ -22,9 +24,11 @@
  */
 #define return_success(RET) { cgm_error.code = cgm_no_error; return (RET); }
 
-// Not a thread-safe solution. But without this the code becomes a total mess.
+// Every thread has its own, so parsers may run in parallel threads. Without
+// this the code becomes a total mess.
 struct cgm_error_struct {
 	int line; // Zero if not applicable.
+	size_t offset; // Byte offset of that line in uncompressed input.
 	int see_errno; // Errno contains something important.
 	enum cgm_error_code {
 		cgm_no_error, // The default.
@@ -34,12 +38,28 @@ struct cgm_error_struct {
 		cgm_err_garbage,
 		cgm_err_invalid_byte,
 		cgm_err_indentation,
+		cgm_err_element,
+		cgm_err_too_deep,
+		cgm_err_memory,
+		cgm_err_compressed,
+		cgm_err_escape,
+		cgm_err_memory_limit,
+		cgm_err_decompressed_limit,
 		cgm_error_code_count
 	} code;
 };
 
-extern struct cgm_error_struct cgm_error;
+extern __thread struct cgm_error_struct cgm_error;
+
+/**
+ * Returns a message describing the current error in cgm_error.
+ */
+const char *cgm_strerror(void);
 
+/**
+ * Displays error with CGM parsing in a user friendly form. Exits the program
+ * with retval and puts file name 'file' to the error message.
+ */
 void cgm_err(int retval, const char *file);
 
 #endif /* cgm_error.h */
@@ -0,0 +1,436 @@
+/**
+ * Element name index. See cgm_index.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for struct stat
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "cgm_error.h"
+#include "cgm_index.h"
+
+#define CGM_INDEX_VERSION 2
+
+/**
+ * Initializes an empty index. Returns 0 on success and -1 if out of memory.
+ */
+int cgm_index_init(struct cgm_index *index)
+{
+	index->postings = NULL;
+	index->postings_alloc = 0;
+	index->nodes = 0;
+	return cgm_symbols_init(&index->names);
+}
+
+/**
+ * Frees the memory of the index.
+ */
+void cgm_index_free(struct cgm_index *index)
+{
+	// Names may be more than postings if growing them failed.
+	for (int i = 0; i < index->postings_alloc; i++)
+		free(index->postings[i].items);
+	free(index->postings);
+	cgm_symbols_free(&index->names);
+	index->postings = NULL;
+	index->postings_alloc = 0;
+	index->nodes = 0;
+}
+
+/**
+ * Returns the index's own ID of the name, adding it if needed. Returns -1
+ * if out of memory.
+ */
+static int cgm_index_name(struct cgm_index *index, const unsigned char *name,
+			  int length)
+{
+	int id = cgm_symbols_intern(&index->names, name, length);
+	if (id == -1) return -1;
+
+	if (id >= index->postings_alloc) {
+		int alloc = index->postings_alloc ?
+			2 * index->postings_alloc : 16;
+		struct cgm_postings *p = realloc(index->postings,
+						 alloc * sizeof(*p));
+		if (p == NULL) return -1;
+		memset(p + index->postings_alloc, 0,
+		       (alloc - index->postings_alloc) * sizeof(*p));
+		index->postings = p;
+		index->postings_alloc = alloc;
+	}
+	return id;
+}
+
+/**
+ * Appends a posting. Returns its position in the list or -1 if out of
+ * memory.
+ */
+static int cgm_index_add(struct cgm_postings *list, struct cgm_posting item)
+{
+	if (list->count == list->alloc) {
+		int alloc = list->alloc ? 2 * list->alloc : 8;
+		struct cgm_posting *p = realloc(list->items,
+						alloc * sizeof(*p));
+		if (p == NULL) return -1;
+		list->items = p;
+		list->alloc = alloc;
+	}
+	list->items[list->count] = item;
+	return list->count++;
+}
+
+/**
+ * Returns the postings of given name or NULL if there are no elements with
+ * that name. Number of postings is written to count.
+ */
+const struct cgm_posting *cgm_index_lookup(const struct cgm_index *index,
+					   const char *name, int *count)
+{
+	int id = cgm_symbols_find(&index->names, (const unsigned char *)name,
+				  strlen(name));
+	if (id == -1 || id >= index->postings_alloc ||
+	    index->postings[id].count == 0) {
+		*count = 0;
+		return NULL;
+	}
+
+	*count = index->postings[id].count;
+	return index->postings[id].items;
+}
+
+struct index_emitter {
+	struct cgm_index *index;
+	struct cgm_emitter inner;
+	int has_inner;
+	int *id_map;        // parser's ID to index's ID + 1, 0 if unknown
+	int id_map_alloc;
+	struct {
+		int id;     // index's name ID
+		int item;   // position in the postings of the name
+	} *open;            // elements not ended yet
+	int open_count;
+	int open_alloc;
+	int failed;         // out of memory
+};
+
+static void index_start_document(void *data, const char *original)
+{
+	struct index_emitter *ie = data;
+
+	if (ie->has_inner) ie->inner.start_document(ie->inner.data, original);
+}
+
+static void index_start_element(void *data, int id, const unsigned char *name,
+				int name_length)
+{
+	struct index_emitter *ie = data;
+	struct cgm_index *index = ie->index;
+
+	if (ie->has_inner)
+		ie->inner.start_element(ie->inner.data, id, name, name_length);
+	if (ie->failed) return;
+
+	// Parser's IDs are mapped to ours, so names are hashed only once.
+	if (id >= ie->id_map_alloc) {
+		int alloc = ie->id_map_alloc ? 2 * ie->id_map_alloc : 16;
+		while (alloc <= id) alloc *= 2;
+		int *p = realloc(ie->id_map, alloc * sizeof(*p));
+		if (p == NULL) goto fail;
+		memset(p + ie->id_map_alloc, 0,
+		       (alloc - ie->id_map_alloc) * sizeof(*p));
+		ie->id_map = p;
+		ie->id_map_alloc = alloc;
+	}
+	if (!ie->id_map[id]) {
+		int own = cgm_index_name(index, name, name_length);
+		if (own == -1) goto fail;
+		ie->id_map[id] = own + 1;
+	}
+	int own = ie->id_map[id] - 1;
+
+	struct cgm_posting item;
+	item.ordinal = index->nodes;
+	item.last = index->nodes;
+	item.depth = ie->open_count;
+	item.line = cgm_error.line;
+	item.offset = cgm_error.offset;
+	int pos = cgm_index_add(&index->postings[own], item);
+	if (pos == -1) goto fail;
+	index->nodes++;
+
+	if (ie->open_count == ie->open_alloc) {
+		int alloc = ie->open_alloc ? 2 * ie->open_alloc : 16;
+		void *p = realloc(ie->open, alloc * sizeof(*ie->open));
+		if (p == NULL) goto fail;
+		ie->open = p;
+		ie->open_alloc = alloc;
+	}
+	ie->open[ie->open_count].id = own;
+	ie->open[ie->open_count].item = pos;
+	ie->open_count++;
+	return;
+fail:
+	ie->failed = 1;
+}
+
+static void index_text(void *data, const unsigned char *text, int length)
+{
+	struct index_emitter *ie = data;
+
+	if (ie->has_inner) ie->inner.text(ie->inner.data, text, length);
+}
+
+static void index_end_element(void *data)
+{
+	struct index_emitter *ie = data;
+
+	if (ie->has_inner) ie->inner.end_element(ie->inner.data);
+	if (ie->failed) return;
+
+	// Everything after the start of this element is its descendant.
+	ie->open_count--;
+	struct cgm_postings *list = &ie->index->postings[
+		ie->open[ie->open_count].id];
+	list->items[ie->open[ie->open_count].item].last =
+		ie->index->nodes - 1;
+}
+
+static void index_end_document(void *data)
+{
+	struct index_emitter *ie = data;
+
+	if (ie->has_inner) ie->inner.end_document(ie->inner.data);
+}
+
+static int index_close(void *data)
+{
+	struct index_emitter *ie = data;
+	int ret = 0;
+
+	if (ie->has_inner && ie->inner.close(ie->inner.data) == -1) ret = -1;
+	if (ie->failed) {
+		errno = ENOMEM;
+		ret = -1;
+	}
+
+	free(ie->id_map);
+	free(ie->open);
+	free(ie);
+	return ret;
+}
+
+/**
+ * Opens an emitter which adds the elements of the parsed document to the
+ * index. All events are passed to inner emitter too, unless it is NULL, so
+ * the index can be built while converting. Lines and offsets are taken
+ * from cgm_error, so the emitter must be used with the parser directly.
+ * Closing the emitter closes the inner emitter but doesn't free the index.
+ * In case of error, data is NULL.
+ */
+struct cgm_emitter cgm_index_emitter(struct cgm_index *index,
+				     struct cgm_emitter *inner)
+{
+	struct cgm_emitter emitter;
+	emitter.start_document = index_start_document;
+	emitter.start_element = index_start_element;
+	emitter.text = index_text;
+	emitter.end_element = index_end_element;
+	emitter.end_document = index_end_document;
+	emitter.close = index_close;
+	emitter.data = NULL; // Set if everything is ok.
+
+	struct index_emitter *ie = malloc(sizeof(struct index_emitter));
+	if (ie == NULL) return emitter;
+	ie->index = index;
+	ie->has_inner = inner != NULL;
+	if (inner != NULL) ie->inner = *inner;
+	ie->id_map = NULL;
+	ie->id_map_alloc = 0;
+	ie->open = NULL;
+	ie->open_count = 0;
+	ie->open_alloc = 0;
+	ie->failed = 0;
+
+	emitter.data = ie;
+	return emitter;
+}
+
+/*
+ * The file format. All integers are big-endian.
+ *
+ * "CGMI", version byte, source size (64 bits), source modification time
+ * in nanoseconds (64 bits), number of elements (32 bits), number of names
+ * (32 bits) and for every name: length (32 bits), the name, number of
+ * postings (32 bits) and postings as ordinal, last, depth and line (32 bits
+ * each) and offset (64 bits).
+ */
+
+static void put32(FILE *f, uint32_t v)
+{
+	unsigned char b[4] = { v >> 24, v >> 16, v >> 8, v };
+	fwrite(b, 1, 4, f);
+}
+
+static void put64(FILE *f, uint64_t v)
+{
+	put32(f, v >> 32);
+	put32(f, v);
+}
+
+static int get32(FILE *f, uint32_t *v)
+{
+	unsigned char b[4];
+	if (fread(b, 1, 4, f) != 4) return -1;
+	*v = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 |
+		(uint32_t)b[2] << 8 | b[3];
+	return 0;
+}
+
+static int get64(FILE *f, uint64_t *v)
+{
+	uint32_t hi, lo;
+	if (get32(f, &hi) == -1 || get32(f, &lo) == -1) return -1;
+	*v = (uint64_t)hi << 32 | lo;
+	return 0;
+}
+
+/**
+ * Returns modification time in nanoseconds, so rewrites within the same
+ * second are noticed too.
+ */
+static uint64_t mtime_ns(const struct stat *stats)
+{
+	return (uint64_t)stats->st_mtim.tv_sec * 1000000000 +
+		stats->st_mtim.tv_nsec;
+}
+
+/**
+ * Returns malloc'd path of the index file of cgm_file or NULL.
+ */
+static char *cgm_index_path(const char *cgm_file)
+{
+	char *path = malloc(strlen(cgm_file) + 5);
+	if (path != NULL) sprintf(path, "%s.idx", cgm_file);
+	return path;
+}
+
+/**
+ * Saves the index next to the source file, to "cgm_file.idx". Size and
+ * modification time of the source are stored with it. Returns 0 on
+ * success and -1 on error. Errno is set in case of error.
+ */
+int cgm_index_save(const struct cgm_index *index, const char *cgm_file)
+{
+	struct stat stats;
+	if (stat(cgm_file, &stats) == -1) return -1;
+
+	char *path = cgm_index_path(cgm_file);
+	if (path == NULL) return -1;
+	FILE *f = fopen(path, "wb");
+	free(path);
+	if (f == NULL) return -1;
+
+	fputs("CGMI", f);
+	putc(CGM_INDEX_VERSION, f);
+	put64(f, stats.st_size);
+	put64(f, mtime_ns(&stats));
+	// A name interned when its postings could not be allocated has none.
+	int count = index->names.count < index->postings_alloc ?
+		index->names.count : index->postings_alloc;
+
+	put32(f, index->nodes);
+	put32(f, count);
+
+	for (int id = 0; id < count; id++) {
+		const struct cgm_symbol *sym = &index->names.symbols[id];
+		const struct cgm_postings *list = &index->postings[id];
+
+		put32(f, sym->length);
+		fwrite(sym->name, 1, sym->length, f);
+		put32(f, list->count);
+		for (int i = 0; i < list->count; i++) {
+			put32(f, list->items[i].ordinal);
+			put32(f, list->items[i].last);
+			put32(f, list->items[i].depth);
+			put32(f, list->items[i].line);
+			put64(f, list->items[i].offset);
+		}
+	}
+
+	int ret = ferror(f) ? -1 : 0;
+	if (fclose(f) == EOF) ret = -1;
+	return ret;
+}
+
+/**
+ * Loads the index of given source file saved with cgm_index_save() to an
+ * initialized, empty index. Returns 0 on success and -1 on error. If the
+ * source file has changed after saving, errno is ESTALE.
+ */
+int cgm_index_load(struct cgm_index *index, const char *cgm_file)
+{
+	struct stat stats;
+	if (stat(cgm_file, &stats) == -1) return -1;
+
+	char *path = cgm_index_path(cgm_file);
+	if (path == NULL) return -1;
+	FILE *f = fopen(path, "rb");
+	free(path);
+	if (f == NULL) return -1;
+
+	char magic[5];
+	uint64_t size, mtime;
+	uint32_t names;
+	unsigned char *name = NULL;
+
+	if (fread(magic, 1, 5, f) != 5 || memcmp(magic, "CGMI", 4) ||
+	    magic[4] != CGM_INDEX_VERSION) goto invalid;
+	if (get64(f, &size) == -1 || get64(f, &mtime) == -1 ||
+	    get32(f, &index->nodes) == -1 || get32(f, &names) == -1)
+		goto invalid;
+
+	if (size != (uint64_t)stats.st_size ||
+	    mtime != mtime_ns(&stats)) {
+		fclose(f);
+		errno = ESTALE;
+		return -1;
+	}
+
+	for (uint32_t n = 0; n < names; n++) {
+		uint32_t length, count;
+		if (get32(f, &length) == -1) goto invalid;
+
+		name = malloc(length ? length : 1);
+		if (name == NULL) goto fail;
+		if (fread(name, 1, length, f) != length) goto invalid;
+		int id = cgm_index_name(index, name, length);
+		free(name);
+		name = NULL;
+		if (id == -1) goto fail;
+
+		if (get32(f, &count) == -1) goto invalid;
+		struct cgm_postings *list = &index->postings[id];
+		for (uint32_t i = 0; i < count; i++) {
+			struct cgm_posting item;
+			if (get32(f, &item.ordinal) == -1 ||
+			    get32(f, &item.last) == -1 ||
+			    get32(f, &item.depth) == -1 ||
+			    get32(f, &item.line) == -1 ||
+			    get64(f, &item.offset) == -1) goto invalid;
+			if (cgm_index_add(list, item) == -1) goto fail;
+		}
+	}
+
+	fclose(f);
+	return 0;
+invalid:
+	errno = EINVAL;
+fail:
+	free(name);
+	fclose(f);
+	return -1;
+}
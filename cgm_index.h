@@ -0,0 +1,81 @@
+#ifndef CGM_INDEX_H
+#define CGM_INDEX_H   1
+
+/**
+ * Element name index. Maps every element name of a document to the list of
+ * its elements in document order, so finding all elements with a given
+ * name costs O(matches) instead of a walk over the whole document. Every
+ * element has the line and byte offset where it starts, so the source can
+ * be read from there without parsing anything before it. The index is
+ * built by an emitter during parsing and can be saved next to the source
+ * file.
+ */
+
+#include <stdint.h>
+#include "cgm_emitter.h"
+#include "cgm_symbols.h"
+
+struct cgm_posting {
+	uint32_t ordinal; // position of the element in document order, from 0
+	uint32_t last;    // ordinal of its last descendant (or itself)
+	uint32_t depth;   // 0 for children of the document
+	uint32_t line;    // line number of the element in the source
+	uint64_t offset;  // byte offset of that line in uncompressed source
+};
+
+struct cgm_postings {
+	struct cgm_posting *items; // sorted by ordinal
+	int count;
+	int alloc;
+};
+
+struct cgm_index {
+	struct cgm_symbols names;     // index's own name IDs
+	struct cgm_postings *postings; // indexed by name ID
+	int postings_alloc;
+	uint32_t nodes;               // number of elements in the document
+};
+
+/**
+ * Initializes an empty index. Returns 0 on success and -1 if out of memory.
+ */
+int cgm_index_init(struct cgm_index *index);
+
+/**
+ * Frees the memory of the index.
+ */
+void cgm_index_free(struct cgm_index *index);
+
+/**
+ * Opens an emitter which adds the elements of the parsed document to the
+ * index. All events are passed to inner emitter too, unless it is NULL, so
+ * the index can be built while converting. Lines and offsets are taken
+ * from cgm_error, so the emitter must be used with the parser directly.
+ * Closing the emitter closes the inner emitter but doesn't free the index.
+ * In case of error, data is NULL.
+ */
+struct cgm_emitter cgm_index_emitter(struct cgm_index *index,
+				     struct cgm_emitter *inner);
+
+/**
+ * Returns the postings of given name or NULL if there are no elements with
+ * that name. Number of postings is written to count.
+ */
+const struct cgm_posting *cgm_index_lookup(const struct cgm_index *index,
+					   const char *name, int *count);
+
+/**
+ * Saves the index next to the source file, to "cgm_file.idx". Size and
+ * modification time of the source are stored with it. Returns 0 on
+ * success and -1 on error. Errno is set in case of error.
+ */
+int cgm_index_save(const struct cgm_index *index, const char *cgm_file);
+
+/**
+ * Loads the index of given source file saved with cgm_index_save() to an
+ * initialized, empty index. Returns 0 on success and -1 on error. If the
+ * source file has changed after saving, errno is ESTALE.
+ */
+int cgm_index_load(struct cgm_index *index, const char *cgm_file);
+
+#endif /* cgm_index.h */
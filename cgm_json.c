@@ -0,0 +1,136 @@
+/**
+ * JSON output backend of the CGM parser. Writes directly to the output file
+ * without building any tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgm_emitter.h"
+
+struct json_emitter {
+	FILE *out;
+	int first; // Next value is the first one in its array.
+};
+
+/**
+ * Writes a JSON string literal. UTF-8 is passed as is, only quotes,
+ * backslashes and control characters are escaped.
+ */
+static void json_write_string(FILE *out, const unsigned char *str, int length)
+{
+	const unsigned char *end = str + length;
+	const unsigned char *run = str; // Start of bytes not written yet.
+
+	putc('"', out);
+	for (; str < end; str++) {
+		if (*str >= 0x20 && *str != '"' && *str != '\\') continue;
+
+		fwrite(run, 1, str - run, out);
+		run = str + 1;
+
+		switch (*str) {
+		case '"':  fputs("\\\"", out); break;
+		case '\\': fputs("\\\\", out); break;
+		case '\n': fputs("\\n", out); break;
+		case '\t': fputs("\\t", out); break;
+		default:   fprintf(out, "\\u%04x", *str);
+		}
+	}
+	fwrite(run, 1, end - run, out);
+	putc('"', out);
+}
+
+/**
+ * Writes a comma if this is not the first value of the array.
+ */
+static void json_separate(struct json_emitter *json)
+{
+	if (!json->first) putc(',', json->out);
+	json->first = 0;
+}
+
+static void json_start_document(void *data, const char *original)
+{
+	struct json_emitter *json = data;
+
+	fputs("{\"original\":", json->out);
+	json_write_string(json->out, (const unsigned char *)original,
+			  strlen(original));
+	fputs(",\"children\":[", json->out);
+	json->first = 1;
+}
+
+static void json_start_element(void *data, int id, const unsigned char *name,
+			       int name_length)
+{
+	struct json_emitter *json = data;
+	(void)id; // Names are written as such
+
+	json_separate(json);
+	fputs("{\"name\":", json->out);
+	json_write_string(json->out, name, name_length);
+	fputs(",\"children\":[", json->out);
+	json->first = 1;
+}
+
+static void json_text(void *data, const unsigned char *text, int length)
+{
+	struct json_emitter *json = data;
+
+	json_separate(json);
+	json_write_string(json->out, text, length);
+}
+
+static void json_end_element(void *data)
+{
+	struct json_emitter *json = data;
+
+	fputs("]}", json->out);
+	json->first = 0;
+}
+
+static void json_end_document(void *data)
+{
+	struct json_emitter *json = data;
+
+	fputs("]}\n", json->out);
+}
+
+static int json_close(void *data)
+{
+	struct json_emitter *json = data;
+	int ret = 0;
+
+	if (fflush(json->out) == EOF || ferror(json->out)) ret = -1;
+
+	free(json);
+	return ret;
+}
+
+/**
+ * Opens an emitter which writes JSON to out. Elements are objects
+ * {"name": "...", "children": [...]} and text is strings. Document is an
+ * object {"original": "...", "children": [...]}. In case of error, data is
+ * NULL.
+ */
+struct cgm_emitter cgm_json_emitter(FILE *out)
+{
+	struct cgm_emitter emitter;
+	emitter.start_document = json_start_document;
+	emitter.start_element = json_start_element;
+	emitter.text = json_text;
+	emitter.end_element = json_end_element;
+	emitter.end_document = json_end_document;
+	emitter.close = json_close;
+	emitter.data = NULL; // Set if everything is ok.
+
+	struct json_emitter *json = malloc(sizeof(struct json_emitter));
+	if (json == NULL) return emitter;
+	json->out = out;
+	json->first = 1;
+
+	emitter.data = json;
+	return emitter;
+}
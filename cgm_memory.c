@@ -0,0 +1,202 @@
+/**
+ * Memory accounting of libxml2. See cgm_memory.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <libxml/xmlmemory.h>
+
+#include "cgm_memory.h"
+
+#define CLASS_COUNT 9           // sizes 16, 32, ... 4096 bytes
+#define HEADER_SIZE 16          // keeps the alignment of malloc()
+#define CLASS_CACHE (128*1024)  // bytes waiting in one size class at most
+
+static size_t memory_limit; // Set before there are threads.
+
+static __thread long long live;
+static __thread long long peak;
+static __thread int exceeded;
+
+// Free blocks by size class. The next block is stored in the data.
+static __thread unsigned char *free_list[CLASS_COUNT];
+static __thread size_t cached[CLASS_COUNT];
+
+/**
+ * Returns the size class of size or -1 if it is too big for any.
+ */
+static int size_class(size_t size)
+{
+	int c = 0;
+	while (c < CLASS_COUNT && (size_t)16 << c < size) c++;
+	return c == CLASS_COUNT ? -1 : c;
+}
+
+/**
+ * Counts size bytes as live. Returns -1 if that goes over the limit.
+ */
+static int memory_charge(size_t size)
+{
+	if (memory_limit && live + (long long)size > (long long)memory_limit) {
+		exceeded = 1;
+		return -1;
+	}
+	live += size;
+	if (live > peak) peak = live;
+	return 0;
+}
+
+static void *memory_malloc(size_t size)
+{
+	int c = size_class(size);
+	size_t capacity = c == -1 ? size : (size_t)16 << c;
+	unsigned char *p;
+
+	if (capacity > SIZE_MAX - HEADER_SIZE) return NULL;
+	if (memory_charge(capacity) == -1) return NULL;
+
+	if (c != -1 && free_list[c] != NULL) {
+		p = free_list[c];
+		memcpy(&free_list[c], p + HEADER_SIZE, sizeof(p));
+		cached[c] -= capacity;
+	} else {
+		p = malloc(HEADER_SIZE + capacity);
+		if (p == NULL) {
+			live -= capacity;
+			return NULL;
+		}
+	}
+
+	memcpy(p, &capacity, sizeof(capacity));
+	return p + HEADER_SIZE;
+}
+
+static void memory_free(void *ptr)
+{
+	if (ptr == NULL) return;
+
+	unsigned char *p = (unsigned char *)ptr - HEADER_SIZE;
+	size_t capacity;
+	memcpy(&capacity, p, sizeof(capacity));
+	live -= capacity;
+
+	int c = size_class(capacity);
+	if (c != -1 && cached[c] + capacity <= CLASS_CACHE) {
+		memcpy(p + HEADER_SIZE, &free_list[c], sizeof(p));
+		free_list[c] = p;
+		cached[c] += capacity;
+	} else {
+		free(p);
+	}
+}
+
+static void *memory_realloc(void *ptr, size_t size)
+{
+	if (ptr == NULL) return memory_malloc(size);
+
+	unsigned char *p = (unsigned char *)ptr - HEADER_SIZE;
+	size_t capacity;
+	memcpy(&capacity, p, sizeof(capacity));
+	int c = size_class(capacity);
+	int new_c = size_class(size);
+
+	// Same size class fits already.
+	if (c != -1 && c == new_c) return ptr;
+
+	// Big blocks stay with malloc() which may resize them in place.
+	if (c == -1 && new_c == -1) {
+		if (size > SIZE_MAX - HEADER_SIZE) return NULL;
+		if (size > capacity && memory_charge(size - capacity) == -1)
+			return NULL;
+
+		unsigned char *n = realloc(p, HEADER_SIZE + size);
+		if (n == NULL) {
+			if (size > capacity) live -= size - capacity;
+			return NULL;
+		}
+		if (size < capacity) live -= capacity - size;
+		memcpy(n, &size, sizeof(size));
+		return n + HEADER_SIZE;
+	}
+
+	void *n = memory_malloc(size);
+	if (n == NULL) return NULL;
+	memcpy(n, ptr, size < capacity ? size : capacity);
+	memory_free(ptr);
+	return n;
+}
+
+static char *memory_strdup(const char *str)
+{
+	size_t size = strlen(str) + 1;
+	char *p = memory_malloc(size);
+
+	if (p != NULL) memcpy(p, str, size);
+	return p;
+}
+
+/**
+ * Installs the allocator to libxml2 with given limit of live bytes per
+ * thread, 0 for no limit. Must be called before anything else of libxml2
+ * and before there are other threads. Returns 0 on success and -1 on
+ * error.
+ */
+int cgm_memory_setup(size_t limit)
+{
+	memory_limit = limit;
+	return xmlMemSetup(memory_free, memory_malloc, memory_realloc,
+			   memory_strdup);
+}
+
+/**
+ * Starts counting a new document in the calling thread.
+ */
+void cgm_memory_reset(void)
+{
+	live = 0;
+	peak = 0;
+	exceeded = 0;
+}
+
+/**
+ * Returns bytes allocated and not freed since cgm_memory_reset() in the
+ * calling thread. Negative if more was freed than allocated.
+ */
+long long cgm_memory_live(void)
+{
+	return live;
+}
+
+/**
+ * Returns the largest value of cgm_memory_live() since cgm_memory_reset().
+ */
+long long cgm_memory_peak(void)
+{
+	return peak;
+}
+
+/**
+ * Returns non-zero if an allocation has failed because of the limit since
+ * cgm_memory_reset() in the calling thread.
+ */
+int cgm_memory_exceeded(void)
+{
+	return exceeded;
+}
+
+/**
+ * Returns blocks waiting in the size classes of the calling thread back to
+ * malloc(). Threads call this before they exit.
+ */
+void cgm_memory_release(void)
+{
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		while (free_list[c] != NULL) {
+			unsigned char *p = free_list[c];
+			memcpy(&free_list[c], p + HEADER_SIZE, sizeof(p));
+			free(p);
+		}
+		cached[c] = 0;
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef CGM_MEMORY_H
+#define CGM_MEMORY_H   1
+
+/**
+ * Memory accounting of libxml2. The allocator is installed with
+ * xmlMemSetup() and serves small blocks from size classes, which are
+ * recycled in the thread freeing them instead of going back to malloc().
+ *
+ * Every thread counts the bytes it has allocated and freed since
+ * cgm_memory_reset(), so a thread converting one document at a time gets
+ * the live and peak bytes of that document. Allocations going over the
+ * limit fail, and the parser stops with cgm_err_memory_limit. Blocks
+ * waiting in the size classes are not counted.
+ */
+
+#include <stddef.h>
+
+/**
+ * Installs the allocator to libxml2 with given limit of live bytes per
+ * thread, 0 for no limit. Must be called before anything else of libxml2
+ * and before there are other threads. Returns 0 on success and -1 on
+ * error.
+ */
+int cgm_memory_setup(size_t limit);
+
+/**
+ * Starts counting a new document in the calling thread.
+ */
+void cgm_memory_reset(void);
+
+/**
+ * Returns bytes allocated and not freed since cgm_memory_reset() in the
+ * calling thread. Negative if more was freed than allocated.
+ */
+long long cgm_memory_live(void);
+
+/**
+ * Returns the largest value of cgm_memory_live() since cgm_memory_reset().
+ */
+long long cgm_memory_peak(void);
+
+/**
+ * Returns non-zero if an allocation has failed because of the limit since
+ * cgm_memory_reset() in the calling thread.
+ */
+int cgm_memory_exceeded(void);
+
+/**
+ * Returns blocks waiting in the size classes of the calling thread back to
+ * malloc(). Threads call this before they exit.
+ */
+void cgm_memory_release(void);
+
+#endif /* cgm_memory.h */
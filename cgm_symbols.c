@@ -0,0 +1,152 @@
+/**
+ * Symbol table for element names. Open addressing hash table with linear
+ * probing which is kept at most half full.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgm_symbols.h"
+
+static const int initial_slots = 64; // power of two
+
+/**
+ * FNV-1a. Names are short so this is as fast as anything fancier.
+ */
+static unsigned int cgm_symbols_hash(const unsigned char *name, int length)
+{
+	unsigned int hash = 2166136261u;
+
+	for (int i = 0; i < length; i++) {
+		hash ^= name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Returns the slot of the name or the free slot where it belongs.
+ */
+static int cgm_symbols_slot(const struct cgm_symbols *table,
+			    const unsigned char *name, int length,
+			    unsigned int hash)
+{
+	unsigned int mask = table->slot_count - 1;
+	unsigned int i = hash & mask;
+
+	while (table->slots[i]) {
+		const struct cgm_symbol *sym =
+			&table->symbols[table->slots[i] - 1];
+		if (sym->hash == hash && sym->length == length &&
+		    memcmp(sym->name, name, length) == 0) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/**
+ * Doubles the size of the hash table. Returns 0 on success and -1 if out
+ * of memory.
+ */
+static int cgm_symbols_grow(struct cgm_symbols *table)
+{
+	int *old = table->slots;
+	int old_count = table->slot_count;
+
+	table->slots = calloc(2 * old_count, sizeof(int));
+	if (table->slots == NULL) {
+		table->slots = old;
+		return -1;
+	}
+	table->slot_count = 2 * old_count;
+
+	for (int i = 0; i < old_count; i++) {
+		if (!old[i]) continue;
+		const struct cgm_symbol *sym = &table->symbols[old[i] - 1];
+		int slot = cgm_symbols_slot(table, sym->name, sym->length,
+					    sym->hash);
+		table->slots[slot] = old[i];
+	}
+
+	free(old);
+	return 0;
+}
+
+/**
+ * Initializes an empty symbol table. Returns 0 on success and -1 if out of
+ * memory.
+ */
+int cgm_symbols_init(struct cgm_symbols *table)
+{
+	table->symbols = NULL;
+	table->count = 0;
+	table->alloc = 0;
+	table->slot_count = initial_slots;
+	table->slots = calloc(initial_slots, sizeof(int));
+	return table->slots == NULL ? -1 : 0;
+}
+
+/**
+ * Returns the ID of the given name. New names are added to the table.
+ * Returns -1 if out of memory.
+ */
+int cgm_symbols_intern(struct cgm_symbols *table, const unsigned char *name,
+		       int length)
+{
+	unsigned int hash = cgm_symbols_hash(name, length);
+	int slot = cgm_symbols_slot(table, name, length, hash);
+
+	if (table->slots[slot]) return table->slots[slot] - 1; // Found
+
+	// New name. Copying it because the input buffer may go away.
+	if (table->count == table->alloc) {
+		int alloc = table->alloc ? 2 * table->alloc : 16;
+		struct cgm_symbol *p = realloc(table->symbols,
+					       alloc * sizeof(*p));
+		if (p == NULL) return -1;
+		table->symbols = p;
+		table->alloc = alloc;
+	}
+
+	struct cgm_symbol *sym = &table->symbols[table->count];
+	sym->name = malloc(length + 1);
+	if (sym->name == NULL) return -1;
+	memcpy(sym->name, name, length);
+	sym->name[length] = '\0';
+	sym->length = length;
+	sym->hash = hash;
+
+	table->slots[slot] = ++table->count;
+
+	// Keeping the table at most half full
+	if (2 * table->count > table->slot_count &&
+	    cgm_symbols_grow(table) == -1) return -1;
+
+	return table->count - 1;
+}
+
+/**
+ * Returns the ID of the given name or -1 if the name is not in the table.
+ */
+int cgm_symbols_find(const struct cgm_symbols *table,
+		     const unsigned char *name, int length)
+{
+	unsigned int hash = cgm_symbols_hash(name, length);
+	int slot = cgm_symbols_slot(table, name, length, hash);
+
+	return table->slots[slot] - 1;
+}
+
+/**
+ * Frees the memory of the table. Names are not valid anymore.
+ */
+void cgm_symbols_free(struct cgm_symbols *table)
+{
+	for (int i = 0; i < table->count; i++) free(table->symbols[i].name);
+	free(table->symbols);
+	free(table->slots);
+	table->symbols = NULL;
+	table->slots = NULL;
+	table->count = 0;
+	table->alloc = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef CGM_SYMBOLS_H
+#define CGM_SYMBOLS_H   1
+
+/**
+ * Symbol table for element names. Every distinct name gets a small integer
+ * ID, starting from 0 in the order of appearance, so names can be compared
+ * and indexed as integers. Names are copied to the table and stay valid
+ * until the table is freed.
+ */
+
+struct cgm_symbol {
+	unsigned char *name; // NUL-terminated copy of the name
+	int length;          // in bytes, without the NUL
+	unsigned int hash;
+};
+
+struct cgm_symbols {
+	struct cgm_symbol *symbols; // indexed by ID
+	int count;                  // number of IDs in use
+	int alloc;                  // allocated size of symbols
+	int *slots;                 // hash table of ID+1, 0 if free
+	int slot_count;             // size of the hash table, power of two
+};
+
+/**
+ * Initializes an empty symbol table. Returns 0 on success and -1 if out of
+ * memory.
+ */
+int cgm_symbols_init(struct cgm_symbols *table);
+
+/**
+ * Returns the ID of the given name. New names are added to the table.
+ * Returns -1 if out of memory.
+ */
+int cgm_symbols_intern(struct cgm_symbols *table, const unsigned char *name,
+		       int length);
+
+/**
+ * Returns the ID of the given name or -1 if the name is not in the table.
+ */
+int cgm_symbols_find(const struct cgm_symbols *table,
+		     const unsigned char *name, int length);
+
+/**
+ * Frees the memory of the table. Names are not valid anymore.
+ */
+void cgm_symbols_free(struct cgm_symbols *table);
+
+#endif /* cgm_symbols.h */
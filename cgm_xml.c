@@ -0,0 +1,273 @@
+/**
+ * XML output backend of the CGM parser. Builds libxml2 DOM tree and writes
+ * it as a whole or one top-level element at a time.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for pthread_once()
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include "cgm_emitter.h"
+
+struct xml_emitter {
+	xmlDocPtr doc;
+	xmlNodePtr current;        // node receiving new children
+	FILE *out;                 // used when writing the whole tree
+	xmlOutputBufferPtr stream; // NULL if not streaming
+	int empty;                 // nothing is written inside root yet
+	const xmlChar **names;     // dictionary names by symbol ID
+	int names_alloc;           // allocated size of names
+	int failed;                // out of memory, output is incomplete
+};
+
+static void xml_start_document(void *data, const char *original)
+{
+	struct xml_emitter *xml = data;
+
+	// Out of memory makes the emitter ignore the rest of the document,
+	// see xml_close().
+	xml->doc = xmlNewDoc(BAD_CAST "1.0"); // XML 1.0
+	if (xml->doc == NULL) {
+		xml->failed = 1;
+		return;
+	}
+
+	// Element names are shared by all nodes through the dictionary.
+	xml->doc->dict = xmlDictCreate();
+	if (xml->doc->dict == NULL) {
+		xml->failed = 1;
+		return;
+	}
+	
+	// Seems to be correct way to set root namespace. I found it by
+	// trial and error. Libxml2 folks have skipped documentation.
+	
+	xmlNodePtr root = xmlNewNode(NULL, BAD_CAST "cgm");
+	if (root == NULL) {
+		xml->failed = 1;
+		return;
+	}
+	xmlNewNs(root, BAD_CAST "http://codegrove.org/2009/cgm", NULL);
+	xmlDocSetRootElement(xml->doc, root);
+	xmlNewProp(root, BAD_CAST "original", BAD_CAST original);
+	xml->current = root;
+
+	// In streaming mode the root start tag is written by hand because
+	// its children never exist in the tree at the same time.
+	if (xml->stream != NULL) {
+		xmlChar *escaped = xmlEncodeSpecialChars(xml->doc,
+							 BAD_CAST original);
+		if (escaped == NULL) {
+			xml->failed = 1;
+			return;
+		}
+		xmlOutputBufferWriteString(xml->stream, "<?xml version=\"1.0\" "
+					   "encoding=\"UTF-8\"?>\n"
+					   "<cgm xmlns=\"http://codegrove.org/"
+					   "2009/cgm\" original=\"");
+		xmlOutputBufferWriteString(xml->stream, (char *)escaped);
+		xmlOutputBufferWriteString(xml->stream, "\"");
+		xmlFree(escaped);
+
+		// Start tag is closed when we know if root has children.
+		xml->empty = 1;
+	}
+}
+
+/**
+ * Returns the dictionary name of given symbol ID. Returns NULL if out of
+ * memory.
+ */
+static const xmlChar *xml_name(struct xml_emitter *xml, int id,
+			       const unsigned char *name, int name_length)
+{
+	if (id >= xml->names_alloc) {
+		int alloc = xml->names_alloc ? 2 * xml->names_alloc : 16;
+		while (alloc <= id) alloc *= 2;
+
+		const xmlChar **p = realloc(xml->names, alloc * sizeof(*p));
+		if (p == NULL) return NULL;
+		for (int i = xml->names_alloc; i < alloc; i++) p[i] = NULL;
+		xml->names = p;
+		xml->names_alloc = alloc;
+	}
+
+	if (xml->names[id] == NULL)
+		xml->names[id] = xmlDictLookup(xml->doc->dict, name,
+					       name_length);
+	return xml->names[id];
+}
+
+static void xml_start_element(void *data, int id, const unsigned char *name,
+			      int name_length)
+{
+	struct xml_emitter *xml = data;
+
+	if (xml->failed) return;
+
+	// Name is in the dictionary so the node doesn't copy it.
+	const xmlChar *dict_name = xml_name(xml, id, name, name_length);
+	xmlNodePtr new_el = dict_name == NULL ? NULL :
+		xmlNewDocNode(xml->doc, NULL, dict_name, NULL);
+	if (new_el == NULL) {
+		xml->failed = 1;
+		return;
+	}
+	xmlAddChild(xml->current, new_el);
+
+	// Insert arbitary newline to DOM
+	// TODO better place
+	xmlNodePtr cool_newline = xmlNewTextLen(BAD_CAST "\n", 1);
+	if (cool_newline == NULL) xml->failed = 1;
+	xmlAddChild(xml->current, cool_newline);
+
+	xml->current = new_el;
+}
+
+static void xml_text(void *data, const unsigned char *text, int length)
+{
+	struct xml_emitter *xml = data;
+
+	if (xml->failed) return;
+	xmlNodePtr node = xmlNewTextLen(text, length);
+	if (node == NULL) {
+		xml->failed = 1;
+		return;
+	}
+	xmlAddChild(xml->current, node);
+}
+
+/**
+ * Writes all children of the root element to stream and frees them.
+ */
+static void xml_flush_toplevel(struct xml_emitter *xml)
+{
+	xmlNodePtr root = xmlDocGetRootElement(xml->doc);
+
+	if (xml->empty && root->children != NULL) {
+		xmlOutputBufferWriteString(xml->stream, ">");
+		xml->empty = 0;
+	}
+
+	while (root->children != NULL) {
+		xmlNodePtr node = root->children;
+		xmlNodeDumpOutput(xml->stream, xml->doc, node, 1, 1, "UTF-8");
+		xmlUnlinkNode(node);
+		xmlFreeNode(node);
+	}
+}
+
+static void xml_end_element(void *data)
+{
+	struct xml_emitter *xml = data;
+
+	if (xml->failed) return;
+	xml->current = xml->current->parent;
+
+	// Back at the top level, so the whole block is complete.
+	if (xml->stream != NULL &&
+	    xml->current == xmlDocGetRootElement(xml->doc))
+		xml_flush_toplevel(xml);
+}
+
+static void xml_end_document(void *data)
+{
+	struct xml_emitter *xml = data;
+
+	if (xml->failed) return;
+	if (xml->stream != NULL) {
+		xml_flush_toplevel(xml);
+
+		// Same as libxml2 writes an empty element
+		xmlOutputBufferWriteString(xml->stream,
+					   xml->empty ? "/>\n" : "</cgm>\n");
+	}
+}
+
+static int xml_close(void *data)
+{
+	struct xml_emitter *xml = data;
+	int ret = 0;
+
+	if (xml->stream != NULL) {
+		if (xmlOutputBufferClose(xml->stream) < 0) ret = -1;
+	} else if (xml->doc != NULL && !xml->failed) {
+		/* 
+		 * Dumping document to stdio or file
+		 */
+		xmlOutputBufferPtr buf = xmlOutputBufferCreateFile(xml->out,
+								   NULL);
+		if (buf == NULL ||
+		    xmlSaveFormatFileTo(buf, xml->doc, "UTF-8", 1) < 0)
+			ret = -1;
+	}
+	if (fflush(xml->out) == EOF) ret = -1;
+	if (xml->failed) {
+		// Out of memory earlier, the output is incomplete.
+		ret = -1;
+		errno = ENOMEM;
+	}
+
+	/*free the document */
+	xmlFreeDoc(xml->doc);
+	free(xml->names);
+	free(xml);
+	return ret;
+}
+
+static pthread_once_t xml_initialized = PTHREAD_ONCE_INIT;
+
+/**
+ * Initializes libxml2. Emitters may be opened in many threads at once, but
+ * libxml2 must be initialized only once.
+ */
+static void xml_init(void)
+{
+	LIBXML_TEST_VERSION;
+}
+
+/**
+ * Opens an emitter which builds libxml2 DOM tree and writes it as XML to
+ * out. If streaming is non-zero, every top-level element is written and
+ * freed as soon as it is complete so only one of them is in memory at a
+ * time. In case of error, data is NULL.
+ */
+struct cgm_emitter cgm_xml_emitter(FILE *out, int streaming)
+{
+	struct cgm_emitter emitter;
+	emitter.start_document = xml_start_document;
+	emitter.start_element = xml_start_element;
+	emitter.text = xml_text;
+	emitter.end_element = xml_end_element;
+	emitter.end_document = xml_end_document;
+	emitter.close = xml_close;
+	emitter.data = NULL; // Set if everything is ok.
+
+	pthread_once(&xml_initialized, xml_init);
+
+	struct xml_emitter *xml = malloc(sizeof(struct xml_emitter));
+	if (xml == NULL) return emitter;
+	xml->doc = NULL;
+	xml->current = NULL;
+	xml->out = out;
+	xml->stream = NULL;
+	xml->empty = 0;
+	xml->names = NULL;
+	xml->names_alloc = 0;
+	xml->failed = 0;
+
+	if (streaming) {
+		xml->stream = xmlOutputBufferCreateFile(out, NULL);
+		if (xml->stream == NULL) {
+			free(xml);
+			return emitter;
+		}
+	}
+
+	emitter.data = xml;
+	return emitter;
+}
@@ -0,0 +1,230 @@
+/**
+ * Converts every document of a corpus file, see cgm_corpus.h, to a new
+ * corpus having the outputs with the same indices and names. Documents
+ * which fail are flagged CGM_CORPUS_FAILED in the output. The input is
+ * mapped once and worker threads take documents one at a time, so the
+ * conversion needs no system calls per document.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for getopt(), open_memstream()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+#include <libxml/parser.h>
+
+#include "cgm_error.h"
+#include "cgm_memory.h"
+#include "cgm_emitter.h"
+#include "cgm_corpus.h"
+#include "cgm.h"
+
+struct batch {
+	struct cgm_corpus in;
+	struct cgm_corpus_writer out;
+	const char *in_file;
+	const char *format;
+	int streaming;
+	const struct cgm_options *options;
+	uint64_t next;          // next document without a worker
+	int failed;             // number of documents not converted
+	int write_error;        // errno of the first write error or 0
+	pthread_mutex_t lock;
+};
+
+static void *batch_worker(void *arg);
+
+int main(int argc, char **argv)
+{
+	struct batch batch;
+	struct cgm_options options = { NULL, 1, 0 }; // Documents in parallel
+	int workers = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t memory_limit = 0;
+	int opt;
+
+	batch.format = "xml";
+	batch.streaming = 0;
+	batch.options = &options;
+	batch.next = 0;
+	batch.failed = 0;
+	batch.write_error = 0;
+
+	while ((opt = getopt(argc, argv, "sf:p:j:m:")) != -1) {
+		switch (opt) {
+		case 's':
+			batch.streaming = 1;
+			break;
+		case 'f':
+			batch.format = optarg;
+			break;
+		case 'p':
+			options.path = optarg;
+			break;
+		case 'j':
+			workers = atoi(optarg);
+			break;
+		case 'm':
+			memory_limit = (size_t)atol(optarg) * 1024 * 1024;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (argc - optind != 2 || workers < 1) goto usage;
+	const char *in_file = argv[optind];
+	batch.in_file = in_file;
+	const char *out_file = argv[optind+1];
+
+	if (strcmp(batch.format, "xml") && strcmp(batch.format, "json") &&
+	    strcmp(batch.format, "binary")) goto usage;
+
+	// Decompressed input is held in memory too.
+	options.max_decompressed = memory_limit;
+
+	// Libxml2 is initialized before there are threads.
+	if (cgm_memory_setup(memory_limit) == -1)
+		errx(1, "Can not set up memory accounting");
+	LIBXML_TEST_VERSION;
+
+	if (cgm_corpus_open(&batch.in, in_file) == -1)
+		err(1, "Can not open %s", in_file);
+	if (cgm_corpus_create(&batch.out, out_file, batch.in.count) == -1)
+		err(1, "Can not create %s", out_file);
+	pthread_mutex_init(&batch.lock, NULL);
+
+	pthread_t *threads = malloc(workers * sizeof(pthread_t));
+	if (threads == NULL) err(1, "Can not allocate workers");
+	for (int i = 0; i < workers; i++) {
+		errno = pthread_create(&threads[i], NULL, batch_worker, &batch);
+		if (errno) err(1, "Can not start worker");
+	}
+	for (int i = 0; i < workers; i++) pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&batch.lock);
+
+	if (batch.write_error) {
+		errno = batch.write_error;
+		err(1, "Can not write to %s", out_file);
+	}
+	if (cgm_corpus_finish(&batch.out) == -1)
+		err(1, "Can not write to %s", out_file);
+	cgm_corpus_close(&batch.in);
+	xmlCleanupParser();
+
+	if (batch.failed) errx(1, "%d documents failed", batch.failed);
+	return 0;
+usage:
+	errx(1, "Usage: %s [-s] [-f FORMAT] [-p PATH] [-j WORKERS] [-m MB] "
+	     "CORPUS_FILE OUTPUT_CORPUS\n"
+	     "  -s  streaming XML output\n"
+	     "  -f  output format: xml (default), json or binary\n"
+	     "  -p  output only elements at PATH, eg. person/name\n"
+	     "  -j  number of worker threads (default: one per CPU)\n"
+	     "  -m  memory limit of libxml2 and of decompressed input per "
+	     "document in megabytes\n"
+	     "      (default: none, decompressed 1024 times the input)",
+	     argv[0]);
+}
+
+/**
+ * Opens an emitter of given format. In case of error, data is NULL.
+ */
+static struct cgm_emitter batch_emitter(const char *format, FILE *out,
+					int streaming)
+{
+	if (strcmp(format, "json") == 0) return cgm_json_emitter(out);
+	if (strcmp(format, "binary") == 0) return cgm_binary_emitter(out);
+	return cgm_xml_emitter(out, streaming);
+}
+
+/**
+ * Converts one document to out. Reports errors to standard error and
+ * returns -1 if the document failed.
+ */
+static int batch_convert(struct batch *batch, const char *name,
+			 const struct cgm_corpus_entry *entry, FILE *out)
+{
+	cgm_memory_reset();
+	struct cgm_emitter emitter = batch_emitter(batch->format, out,
+						   batch->streaming);
+	if (emitter.data == NULL) {
+		warnx("%s: Can not initialize %s output", name,
+		      batch->format);
+		return -1;
+	}
+
+	cgm_parse_buffer(entry->data, entry->length, name, batch->options,
+			 &emitter);
+	if (cgm_error.code) {
+		warnx("At document %s:%d: %s", name, cgm_error.line,
+		      cgm_strerror());
+		emitter.close(emitter.data);
+		return -1;
+	}
+	if (emitter.close(emitter.data) == -1 || fflush(out) == EOF) {
+		if (cgm_memory_exceeded())
+			warnx("%s: Memory limit exceeded while writing output",
+			      name);
+		else
+			warn("%s: Can not write output", name);
+		return -1;
+	}
+	return 0;
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch *batch = arg;
+	char *buf = NULL;
+	size_t size = 0;
+
+	while (1) {
+		pthread_mutex_lock(&batch->lock);
+		uint64_t i = batch->next++;
+		int stop = i >= batch->in.count || batch->write_error;
+		pthread_mutex_unlock(&batch->lock);
+		if (stop) break;
+
+		struct cgm_corpus_entry entry;
+		int ret = cgm_corpus_get(&batch->in, i, &entry);
+		const char *name = ret == -1 ? "" : entry.name;
+		if (ret == -1) {
+			warn("Document %llu", (unsigned long long)i);
+		} else if (entry.flags & CGM_CORPUS_FAILED) {
+			warnx("%s: Failed already in %s", name,
+			      batch->in_file);
+			ret = -1;
+		}
+
+		// Memory stream keeps its buffer only until it is closed.
+		FILE *out = open_memstream(&buf, &size);
+		if (out == NULL) {
+			warn("%s: Can not open output", name);
+			ret = -1;
+		}
+		if (ret != -1) ret = batch_convert(batch, name, &entry, out);
+		if (out != NULL) fclose(out);
+
+		// Failed documents keep their names and are flagged.
+		pthread_mutex_lock(&batch->lock);
+		if (ret == -1) {
+			batch->failed++;
+			ret = cgm_corpus_fail(&batch->out, i, name);
+		} else {
+			ret = cgm_corpus_put(&batch->out, i, name, buf, size);
+		}
+		if (ret == -1 && !batch->write_error)
+			batch->write_error = errno;
+		pthread_mutex_unlock(&batch->lock);
+
+		free(buf);
+		buf = NULL;
+	}
+	cgm_memory_release();
+	return NULL;
+}
@@ -0,0 +1,156 @@
+/**
+ * Client of the CGM conversion daemon. Converts the given files or standard
+ * input with a running cgmd and writes the output to standard output.
+ */
+
+#define _XOPEN_SOURCE 700 // for getopt(), getline(), realpath()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cgmd.h"
+
+int cgmc_response(FILE *in, const char *name);
+int cgmc_send_stdin(FILE *out, const char *format);
+
+int main(int argc, char **argv)
+{
+	char *format = "xml";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:")) != -1) {
+		switch (opt) {
+		case 'f':
+			format = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind < 1) goto usage;
+	char *path = argv[optind];
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		errx(1, "Socket path %s is too long", path);
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) err(1, "Can not create socket");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		err(1, "Can not connect to %s", path);
+
+	FILE *in = fdopen(fd, "rb");
+	FILE *out = fdopen(dup(fd), "wb");
+	if (in == NULL || out == NULL) err(1, "Can not open connection");
+
+	int failed = 0;
+	if (argc - optind == 1) {
+		// No files, sending standard input inline.
+		if (cgmc_send_stdin(out, format) == -1)
+			err(1, "Can not send the document");
+		failed |= cgmc_response(in, "-");
+	}
+	for (int i = optind + 1; i < argc; i++) {
+		// The daemon may have another working directory.
+		char full[PATH_MAX];
+		if (realpath(argv[i], full) == NULL) {
+			warn("%s", argv[i]);
+			failed = 1;
+			continue;
+		}
+
+		fprintf(out, "%s " CGMD_FILE " %s\n", format, full);
+		if (fflush(out) == EOF) err(1, "Can not send the request");
+		failed |= cgmc_response(in, argv[i]);
+	}
+
+	fclose(out);
+	fclose(in);
+	return failed;
+usage:
+	errx(1, "Usage: %s [-f FORMAT] SOCKET_PATH [CGM_FILE...]\n"
+	     "Without files, the document is read from standard input.",
+	     argv[0]);
+}
+
+/**
+ * Reads standard input to memory and sends it as a BUFFER request.
+ * Returns 0 on success and -1 on error.
+ */
+int cgmc_send_stdin(FILE *out, const char *format)
+{
+	char *data = NULL;
+	size_t length = 0, alloc = 0;
+
+	while (!feof(stdin)) {
+		if (length == alloc) {
+			alloc = alloc ? 2 * alloc : 65536;
+			char *p = realloc(data, alloc);
+			if (p == NULL) {
+				free(data);
+				return -1;
+			}
+			data = p;
+		}
+		length += fread(data + length, 1, alloc - length, stdin);
+		if (ferror(stdin)) {
+			free(data);
+			return -1;
+		}
+	}
+
+	fprintf(out, "%s " CGMD_BUFFER " %zu\n", format, length);
+	fwrite(data, 1, length, out);
+	free(data);
+
+	return fflush(out) == EOF ? -1 : 0;
+}
+
+/**
+ * Reads a response and writes the output to standard output. Errors are
+ * printed with the given document name. Returns 0 on success and 1 if the
+ * conversion failed. Exits if the connection is broken.
+ */
+int cgmc_response(FILE *in, const char *name)
+{
+	char *line = NULL;
+	size_t line_alloc = 0;
+
+	if (getline(&line, &line_alloc, in) == -1)
+		errx(1, "Connection closed by the daemon");
+	line[strcspn(line, "\n")] = '\0';
+
+	if (strncmp(line, CGMD_ERR " ", strlen(CGMD_ERR " ")) == 0) {
+		char *msg;
+		long err_line = strtol(line + strlen(CGMD_ERR " "), &msg, 10);
+		warnx("At file %s:%ld:%s", name, err_line, msg);
+		free(line);
+		return 1;
+	}
+	if (strncmp(line, CGMD_OK " ", strlen(CGMD_OK " ")) != 0)
+		errx(1, "Invalid response: %s", line);
+
+	size_t length = strtoul(line + strlen(CGMD_OK " "), NULL, 10);
+	free(line);
+
+	// Copying the output in pieces.
+	char buf[65536];
+	while (length > 0) {
+		size_t n = length < sizeof(buf) ? length : sizeof(buf);
+		if (fread(buf, 1, n, in) != n)
+			errx(1, "Connection closed by the daemon");
+		fwrite(buf, 1, n, stdout);
+		length -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,245 @@
+/**
+ * CGM conversion daemon. Listens on a Unix domain socket and converts
+ * documents on request, see cgmd.h for the protocol.
+ *
+ * The daemon forks a pool of workers which accept connections from the
+ * same socket. Libxml2 is initialized once before forking and every worker
+ * keeps its input and output buffers between requests, so a request costs
+ * only the conversion itself. Workers are processes, not threads, so a
+ * document crashing libxml2 takes down only one worker.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for getopt(), getline(), open_memstream()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <err.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <libxml/parser.h>
+
+#include "cgm_error.h"
+#include "cgm_emitter.h"
+#include "cgm.h"
+#include "cgmd.h"
+
+const int default_workers = 4;
+
+/**
+ * Buffers of a worker. These are reused from a request to another.
+ */
+struct worker {
+	FILE *mem;              // output of the conversion
+	char *mem_data;         // buffer of mem, valid after fflush()
+	size_t mem_size;        // bytes in mem_data, valid after fflush()
+	unsigned char *in_data; // document sent by client
+	size_t in_alloc;        // allocated size of in_data
+};
+
+void cgmd_worker(int listen_fd);
+int cgmd_serve(struct worker *worker, FILE *in, FILE *out);
+int cgmd_request(struct worker *worker, char *line, FILE *in, FILE *out);
+
+int main(int argc, char **argv)
+{
+	int workers = default_workers;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:")) != -1) {
+		switch (opt) {
+		case 'w':
+			workers = atoi(optarg);
+			if (workers < 1) goto usage;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 1) goto usage;
+	char *path = argv[optind];
+
+	// Initializing libxml2 only once. Workers inherit it.
+	LIBXML_TEST_VERSION;
+	xmlInitParser();
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		errx(1, "Socket path %s is too long", path);
+	strcpy(addr.sun_path, path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd == -1) err(1, "Can not create socket");
+
+	// Old socket is left behind if the daemon was killed. Anything else
+	// at the path is not ours to remove.
+	struct stat st;
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode))
+			errx(1, "%s exists and is not a socket", path);
+		if (unlink(path) == -1) err(1, "Can not remove %s", path);
+	} else if (errno != ENOENT) {
+		err(1, "Can not access %s", path);
+	}
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		err(1, "Can not bind to %s", path);
+	if (listen(listen_fd, SOMAXCONN) == -1)
+		err(1, "Can not listen %s", path);
+
+	// A client closing early must fail the write, not kill the worker.
+	signal(SIGPIPE, SIG_IGN);
+
+	// Forking the pool and keeping it full.
+	int running = 0;
+	while (1) {
+		for (; running < workers; running++) {
+			pid_t pid = fork();
+			if (pid == -1) err(1, "Can not fork a worker");
+			if (pid == 0) cgmd_worker(listen_fd); // Never returns
+		}
+
+		if (wait(NULL) == -1) {
+			if (errno == EINTR) continue;
+			err(1, "Can not wait for workers");
+		}
+		running--;
+		warnx("Worker died, starting a new one");
+	}
+usage:
+	errx(1, "Usage: %s [-w WORKERS] SOCKET_PATH", argv[0]);
+}
+
+/**
+ * Accepts and serves connections forever.
+ */
+void cgmd_worker(int listen_fd)
+{
+	struct worker worker;
+	worker.mem = open_memstream(&worker.mem_data, &worker.mem_size);
+	if (worker.mem == NULL) err(1, "Can not allocate output buffer");
+	worker.in_data = NULL;
+	worker.in_alloc = 0;
+
+	while (1) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			err(1, "Can not accept connection");
+		}
+
+		// Separate streams for reading and writing the same socket.
+		FILE *in = fdopen(fd, "rb");
+		int out_fd = dup(fd);
+		FILE *out = out_fd == -1 ? NULL : fdopen(out_fd, "wb");
+		if (in == NULL || out == NULL) {
+			warn("Can not open connection");
+			if (in != NULL) fclose(in); else close(fd);
+			if (out != NULL) fclose(out);
+			else if (out_fd != -1) close(out_fd);
+			continue;
+		}
+
+		cgmd_serve(&worker, in, out);
+
+		fclose(in);
+		fclose(out);
+	}
+}
+
+/**
+ * Serves requests until the client closes the connection. Returns 0 when
+ * the connection was closed normally and -1 in case of a broken request or
+ * a write error.
+ */
+int cgmd_serve(struct worker *worker, FILE *in, FILE *out)
+{
+	char *line = NULL;
+	size_t line_alloc = 0;
+	int ret = 0;
+
+	while (getline(&line, &line_alloc, in) != -1) {
+		ret = cgmd_request(worker, line, in, out);
+		if (ret == -1) break;
+	}
+
+	free(line);
+	return ret;
+}
+
+/**
+ * Processes a single request line and writes the response. Returns 0 on
+ * success (also when conversion failed and the client got an error) and -1
+ * if the connection can not be used anymore.
+ */
+int cgmd_request(struct worker *worker, char *line, FILE *in, FILE *out)
+{
+	// Splitting "FORMAT KIND ARGUMENT\n"
+	line[strcspn(line, "\n")] = '\0';
+	char *format = line;
+	char *kind = strchr(format, ' ');
+	if (kind == NULL) return -1;
+	*kind++ = '\0';
+	char *arg = strchr(kind, ' ');
+	if (arg == NULL) return -1;
+	*arg++ = '\0';
+
+	// Reading the inline document before anything else keeps the
+	// connection in sync even if the format is unknown.
+	size_t length = 0;
+	if (strcmp(kind, CGMD_BUFFER) == 0) {
+		length = strtoul(arg, NULL, 10);
+		if (length > worker->in_alloc) {
+			unsigned char *p = realloc(worker->in_data, length);
+			if (p == NULL) return -1;
+			worker->in_data = p;
+			worker->in_alloc = length;
+		}
+		if (fread(worker->in_data, 1, length, in) != length) return -1;
+	} else if (strcmp(kind, CGMD_FILE) != 0) {
+		return -1;
+	}
+
+	// Output buffer is reused, only rewinding it.
+	rewind(worker->mem);
+
+	struct cgm_emitter emitter;
+	if (strcmp(format, "xml") == 0) {
+		emitter = cgm_xml_emitter(worker->mem, 0);
+	} else if (strcmp(format, "json") == 0) {
+		emitter = cgm_json_emitter(worker->mem);
+	} else if (strcmp(format, "binary") == 0) {
+		emitter = cgm_binary_emitter(worker->mem);
+	} else {
+		fprintf(out, CGMD_ERR " 0 Unknown format %s\n", format);
+		return fflush(out) == EOF ? -1 : 0;
+	}
+	if (emitter.data == NULL) return -1;
+
+	if (strcmp(kind, CGMD_BUFFER) == 0)
+		cgm_parse_buffer(worker->in_data, length, "-", NULL,
+				 &emitter);
+	else
+		cgm_parse_file(arg, NULL, &emitter);
+	int parse_errno = errno;
+
+	if (emitter.close(emitter.data) == -1) return -1;
+
+	if (cgm_error.code) {
+		fprintf(out, CGMD_ERR " %d %s%s%s\n", cgm_error.line,
+			cgm_strerror(), cgm_error.see_errno ? ": " : "",
+			cgm_error.see_errno ? strerror(parse_errno) : "");
+	} else {
+		fprintf(out, CGMD_OK " %zu\n", worker->mem_size);
+		fwrite(worker->mem_data, 1, worker->mem_size, out);
+	}
+
+	return fflush(out) == EOF ? -1 : 0;
+}
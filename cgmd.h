@@ -0,0 +1,23 @@
+#ifndef CGMD_H
+#define CGMD_H   1
+
+/**
+ * Protocol of the CGM conversion daemon. Client connects to the Unix domain
+ * socket of the daemon and sends any number of requests, one at a time.
+ *
+ * Request is a line "FORMAT FILE PATH\n" to convert a file readable by the
+ * daemon or "FORMAT BUFFER LENGTH\n" followed by LENGTH bytes of CGM
+ * document. FORMAT is xml, json or binary like in cgm2dom.
+ *
+ * Response is a line "OK LENGTH\n" followed by LENGTH bytes of output or a
+ * line "ERR LINE MESSAGE\n" if conversion failed. LINE is the line number
+ * of the document or 0 if not applicable. After the response the daemon
+ * waits for the next request in the same connection.
+ */
+
+#define CGMD_FILE "FILE"
+#define CGMD_BUFFER "BUFFER"
+#define CGMD_OK "OK"
+#define CGMD_ERR "ERR"
+
+#endif /* cgmd.h */
@@ -0,0 +1,45 @@
+/**
+ * Compares two CGM documents structurally and prints the changed blocks
+ * with their line ranges like diff(1) does, without the contents. Exit
+ * status is 0 if the documents are equal, 1 if they differ and 2 in case
+ * of error.
+ */
+
+#include <stdio.h>
+#include <err.h>
+
+#include "cgm_error.h"
+#include "cgm_diff.h"
+#include "cgm.h"
+
+/**
+ * Parses the file to the tree. Exits in case of error.
+ */
+static void read_tree(struct cgm_tree *tree, const char *cgm_file)
+{
+	if (cgm_tree_init(tree) == -1) err(2, "Can not allocate tree");
+
+	struct cgm_emitter emitter = cgm_tree_emitter(tree);
+	if (emitter.data == NULL) errx(2, "Can not initialize tree");
+
+	cgm_parse_file(cgm_file, NULL, &emitter);
+	if (cgm_error.code) cgm_err(2, cgm_file);
+	if (emitter.close(emitter.data) == -1)
+		err(2, "Can not read %s", cgm_file);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3) errx(2, "Usage: %s OLD_FILE NEW_FILE", argv[0]);
+
+	struct cgm_tree old, new;
+	read_tree(&old, argv[1]);
+	read_tree(&new, argv[2]);
+
+	int changes = cgm_diff(&old, &new, stdout);
+	if (changes == -1) err(2, "Can not compare");
+
+	cgm_tree_free(&old);
+	cgm_tree_free(&new);
+	return changes ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * Finds elements by name using the element name index. The index is read
+ * from CGM_FILE.idx, or built and saved if it is missing or out of date.
+ * Prints name, ordinal, depth, ordinal of the last descendant, line and
+ * byte offset of every matching element, one element per line, in
+ * document order.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#include "cgm_error.h"
+#include "cgm_index.h"
+#include "cgm.h"
+
+/**
+ * Builds the index of cgm_file and saves it. Exits in case of error.
+ */
+static void build_index(struct cgm_index *index, const char *cgm_file)
+{
+	struct cgm_emitter emitter = cgm_index_emitter(index, NULL);
+	if (emitter.data == NULL) errx(1, "Can not initialize index");
+
+	cgm_parse_file(cgm_file, NULL, &emitter);
+	if (cgm_error.code) cgm_err(1, cgm_file);
+	if (emitter.close(emitter.data) == -1)
+		err(1, "Can not index %s", cgm_file);
+
+	if (cgm_index_save(index, cgm_file) == -1)
+		warn("Can not write index of %s", cgm_file);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) errx(1, "Usage: %s CGM_FILE NAME...", argv[0]);
+	const char *cgm_file = argv[1];
+
+	struct cgm_index index;
+	if (cgm_index_init(&index) == -1) err(1, "Can not allocate index");
+
+	if (cgm_index_load(&index, cgm_file) == -1) {
+		if (errno != ENOENT && errno != ESTALE && errno != EINVAL)
+			err(1, "Can not read index of %s", cgm_file);
+
+		// Partially loaded index is thrown away.
+		cgm_index_free(&index);
+		if (cgm_index_init(&index) == -1)
+			err(1, "Can not allocate index");
+		build_index(&index, cgm_file);
+	}
+
+	for (int i = 2; i < argc; i++) {
+		int count;
+		const struct cgm_posting *p = cgm_index_lookup(&index, argv[i],
+							       &count);
+		for (int j = 0; j < count; j++)
+			printf("%s %u %u %u %u %llu\n", argv[i],
+			       p[j].ordinal, p[j].depth, p[j].last, p[j].line,
+			       (unsigned long long)p[j].offset);
+	}
+
+	cgm_index_free(&index);
+	return 0;
+}
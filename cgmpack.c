@@ -0,0 +1,128 @@
+/**
+ * Packs CGM documents to a corpus file, see cgm_corpus.h, and lists or
+ * extracts documents of one.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for getopt()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/stat.h>
+
+#include "mmap.h"
+#include "cgm_corpus.h"
+
+static void pack(const char *corpus_file, char **files, int count);
+static void list(const char *corpus_file);
+static void extract(const char *corpus_file, const char *index);
+
+int main(int argc, char **argv)
+{
+	int opt;
+	char mode = 'c';
+
+	while ((opt = getopt(argc, argv, "lx")) != -1) {
+		switch (opt) {
+		case 'l':
+		case 'x':
+			mode = opt;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (mode == 'c' && argc - optind >= 1)
+		pack(argv[optind], argv + optind + 1, argc - optind - 1);
+	else if (mode == 'l' && argc - optind == 1)
+		list(argv[optind]);
+	else if (mode == 'x' && argc - optind == 2)
+		extract(argv[optind], argv[optind+1]);
+	else
+		goto usage;
+	return 0;
+usage:
+	errx(1, "Usage: %s CORPUS_FILE CGM_FILE...\n"
+	     "       %s -l CORPUS_FILE\n"
+	     "       %s -x CORPUS_FILE INDEX\n"
+	     "  -l  list index, length (or \"failed\") and name of every "
+	     "document\n"
+	     "  -x  write document of given index to standard output",
+	     argv[0], argv[0], argv[0]);
+}
+
+/**
+ * Creates corpus of the files, named by their paths. Exits in case of
+ * error.
+ */
+static void pack(const char *corpus_file, char **files, int count)
+{
+	struct cgm_corpus_writer writer;
+	if (cgm_corpus_create(&writer, corpus_file, count) == -1)
+		err(1, "Can not create %s", corpus_file);
+
+	for (int i = 0; i < count; i++) {
+		// An empty file can not be mapped but is an empty document.
+		struct stat stats;
+		if (stat(files[i], &stats) == -1)
+			err(1, "Can not open %s for reading", files[i]);
+		if (stats.st_size == 0) {
+			if (cgm_corpus_put(&writer, i, files[i], "", 0) == -1)
+				err(1, "Can not write to %s", corpus_file);
+			continue;
+		}
+
+		struct mmap_info in = mmap_fopen(files[i], mmap_mode_readonly);
+		if (in.state == mmap_state_error)
+			err(1, "Can not open %s for reading", files[i]);
+		if (cgm_corpus_put(&writer, i, files[i], in.data,
+				   in.length) == -1)
+			err(1, "Can not write to %s", corpus_file);
+		mmap_close(&in);
+	}
+
+	if (cgm_corpus_finish(&writer) == -1)
+		err(1, "Can not write to %s", corpus_file);
+}
+
+static void list(const char *corpus_file)
+{
+	struct cgm_corpus corpus;
+	if (cgm_corpus_open(&corpus, corpus_file) == -1)
+		err(1, "Can not open %s", corpus_file);
+
+	for (uint64_t i = 0; i < corpus.count; i++) {
+		struct cgm_corpus_entry entry;
+		if (cgm_corpus_get(&corpus, i, &entry) == -1)
+			err(1, "Invalid document %llu in %s",
+			    (unsigned long long)i, corpus_file);
+		if (entry.flags & CGM_CORPUS_FAILED)
+			printf("%llu failed %s\n", (unsigned long long)i,
+			       entry.name);
+		else
+			printf("%llu %zu %s\n", (unsigned long long)i,
+			       entry.length, entry.name);
+	}
+	cgm_corpus_close(&corpus);
+}
+
+static void extract(const char *corpus_file, const char *index)
+{
+	struct cgm_corpus corpus;
+	struct cgm_corpus_entry entry;
+
+	if (cgm_corpus_open(&corpus, corpus_file) == -1)
+		err(1, "Can not open %s", corpus_file);
+	if (cgm_corpus_get(&corpus, strtoull(index, NULL, 10), &entry) == -1)
+		err(1, "No document %s in %s", index, corpus_file);
+	if (entry.flags & CGM_CORPUS_FAILED)
+		errx(1, "Document %s (%s) in %s failed", index, entry.name,
+		     corpus_file);
+
+	if (fwrite(entry.data, 1, entry.length, stdout) != entry.length ||
+	    fflush(stdout) == EOF) err(1, "Can not write output");
+	cgm_corpus_close(&corpus);
+}
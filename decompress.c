@@ -0,0 +1,391 @@
+/**
+ * Decompression of gzip and zstd input to memory. See decompress.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for sysconf()
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "decompress.h"
+
+static const size_t initial_output = 1 << 20; // when size is not known
+
+/**
+ * Detects compression from the magic bytes at the beginning of data.
+ */
+enum decompress_format decompress_detect(const void *data, size_t length)
+{
+	const unsigned char *p = data;
+
+	if (length >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+		return decompress_gzip;
+	if (length >= 4 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd &&
+	    p[0] == 0x28) return decompress_zstd;
+	// Skippable frame may come first, eg. with seekable zstd
+	if (length >= 4 && (p[0] & 0xf0) == 0x50 && p[1] == 0x2a &&
+	    p[2] == 0x4d && p[3] == 0x18) return decompress_zstd;
+	return decompress_none;
+}
+
+/**
+ * Doubles the size of the output, but not over limit unless it is 0.
+ * Returns -1 and sets errno if out of memory or already at the limit.
+ */
+static int decompress_grow(struct mmap_info *out, size_t limit)
+{
+	size_t length = 2 * (size_t)out->length;
+
+	if (limit && length > limit) length = limit;
+	if (length == (size_t)out->length) {
+		errno = EFBIG;
+		return -1;
+	}
+	return mmap_resize(out, length);
+}
+
+/**
+ * Returns the initial size of the output, which is guess but not over
+ * limit unless it is 0.
+ */
+static size_t decompress_initial(size_t guess, size_t limit)
+{
+	return limit && guess > limit ? limit : guess;
+}
+
+/**
+ * Shrinks the output to the decompressed length or fails if there is
+ * nothing, because a mapping can not be empty.
+ */
+static void decompress_finish(struct mmap_info *out, size_t length)
+{
+	if (length == 0) {
+		mmap_close(out);
+		out->state = mmap_state_error;
+		errno = EINVAL;
+	} else if (mmap_resize(out, length) == -1) {
+		mmap_close(out);
+		out->state = mmap_state_error;
+	}
+}
+
+/**
+ * Decompresses all gzip members one after another.
+ */
+static struct mmap_info decompress_gzip_data(const unsigned char *data,
+					     size_t length, size_t limit)
+{
+	// Size of the last member is at the end, a good guess for the rest.
+	size_t guess = initial_output;
+	if (length >= 18) {
+		const unsigned char *t = data + length - 4;
+		size_t size = (size_t)t[0] | (size_t)t[1] << 8 |
+			(size_t)t[2] << 16 | (size_t)t[3] << 24;
+		if (size > guess) guess = size;
+	}
+
+	struct mmap_info out = mmap_anonymous(decompress_initial(guess, limit));
+	if (out.state == mmap_state_error) return out;
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 15 + 16) != Z_OK) { // gzip header only
+		mmap_close(&out);
+		out.state = mmap_state_error;
+		errno = ENOMEM;
+		return out;
+	}
+
+	size_t done = 0;
+	const unsigned char *in = data;
+	size_t in_left = length;
+	int error = 0;
+
+	while (1) {
+		if (done == (size_t)out.length &&
+		    decompress_grow(&out, limit) == -1) {
+			error = errno;
+			break;
+		}
+
+		// zlib counts in unsigned int, so big buffers go in pieces
+		z.next_in = (unsigned char *)in;
+		z.avail_in = in_left > UINT32_MAX ? UINT32_MAX : in_left;
+		z.next_out = (unsigned char *)out.data + done;
+		size_t room = out.length - done;
+		z.avail_out = room > UINT32_MAX ? UINT32_MAX : room;
+		unsigned int avail_in = z.avail_in, avail_out = z.avail_out;
+
+		int ret = inflate(&z, Z_NO_FLUSH);
+		in += avail_in - z.avail_in;
+		in_left -= avail_in - z.avail_in;
+		done += avail_out - z.avail_out;
+
+		if (ret == Z_STREAM_END) {
+			// Concatenated members make a valid gzip file too.
+			if (in_left == 0) break;
+			if (inflateReset(&z) != Z_OK) error = EINVAL;
+		} else if (ret == Z_MEM_ERROR) {
+			error = ENOMEM;
+		} else if (ret == Z_BUF_ERROR && z.avail_out != 0) {
+			error = EINVAL; // Truncated input
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			error = EINVAL;
+		}
+		if (error) break;
+	}
+	inflateEnd(&z);
+
+	if (error) {
+		mmap_close(&out);
+		out.state = mmap_state_error;
+		errno = error;
+		return out;
+	}
+
+	decompress_finish(&out, done);
+	return out;
+}
+
+struct zstd_frame {
+	const unsigned char *src;
+	size_t src_size;
+	size_t offset;    // in the output
+	size_t size;      // decompressed size
+};
+
+struct zstd_job {
+	struct zstd_frame *frames;
+	size_t count;
+	size_t next;            // next frame without a worker
+	unsigned char *out;
+	int failed;             // error code of the first failure or 0
+	pthread_mutex_t lock;
+};
+
+/**
+ * Worker thread. Takes frames one at a time until there are none left.
+ */
+static void *decompress_zstd_worker(void *arg)
+{
+	struct zstd_job *job = arg;
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+	while (1) {
+		pthread_mutex_lock(&job->lock);
+		if (dctx == NULL && !job->failed) job->failed = ENOMEM;
+		size_t i = job->next++;
+		int stop = job->failed || i >= job->count;
+		pthread_mutex_unlock(&job->lock);
+		if (stop) break;
+
+		struct zstd_frame *f = &job->frames[i];
+		size_t ret = ZSTD_decompressDCtx(dctx, job->out + f->offset,
+						 f->size, f->src, f->src_size);
+		if (ZSTD_isError(ret) || ret != f->size) {
+			pthread_mutex_lock(&job->lock);
+			if (!job->failed) job->failed = EINVAL;
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+
+	ZSTD_freeDCtx(dctx);
+	return NULL;
+}
+
+/**
+ * Decompresses zstd input of unknown size with a single stream.
+ */
+static struct mmap_info decompress_zstd_stream(const unsigned char *data,
+					       size_t length, size_t limit)
+{
+	struct mmap_info out =
+		mmap_anonymous(decompress_initial(initial_output, limit));
+	if (out.state == mmap_state_error) return out;
+
+	ZSTD_DStream *zds = ZSTD_createDStream();
+	if (zds == NULL) {
+		mmap_close(&out);
+		out.state = mmap_state_error;
+		errno = ENOMEM;
+		return out;
+	}
+
+	ZSTD_inBuffer in = { data, length, 0 };
+	size_t done = 0;
+	size_t ret = 0;
+	int error = 0;
+
+	while (in.pos < in.size || ret != 0) {
+		if (done == (size_t)out.length &&
+		    decompress_grow(&out, limit) == -1) {
+			error = errno;
+			break;
+		}
+		ZSTD_outBuffer o = { out.data, out.length, done };
+		size_t in_pos = in.pos;
+
+		ret = ZSTD_decompressStream(zds, &o, &in);
+		if (ZSTD_isError(ret)) {
+			error = EINVAL;
+			break;
+		}
+		// No progress with room left means truncated input.
+		if (o.pos == done && in.pos == in_pos && o.pos < o.size) {
+			error = EINVAL;
+			break;
+		}
+		done = o.pos;
+	}
+	ZSTD_freeDStream(zds);
+
+	if (error) {
+		mmap_close(&out);
+		out.state = mmap_state_error;
+		errno = error;
+		return out;
+	}
+
+	decompress_finish(&out, done);
+	return out;
+}
+
+/**
+ * Decompresses zstd frames in parallel straight to their place in the
+ * output. Frame headers tell the sizes, so every frame has its own place
+ * before any of them is decompressed. If any size is missing, the data is
+ * decompressed with a single stream instead.
+ */
+static struct mmap_info decompress_zstd_data(const unsigned char *data,
+					     size_t length, int threads,
+					     size_t limit)
+{
+	struct mmap_info out;
+	out.state = mmap_state_error; // Reset if everything is ok.
+
+	struct zstd_job job;
+	job.frames = NULL;
+	job.count = 0;
+	job.next = 0;
+	job.failed = 0;
+	size_t alloc = 0;
+	size_t total = 0;
+
+	for (size_t pos = 0; pos < length;) {
+		size_t src_size = ZSTD_findFrameCompressedSize(data + pos,
+							       length - pos);
+		unsigned long long size =
+			ZSTD_getFrameContentSize(data + pos, length - pos);
+		if (ZSTD_isError(src_size) || size == ZSTD_CONTENTSIZE_ERROR) {
+			free(job.frames);
+			errno = EINVAL;
+			return out;
+		}
+		if (size == ZSTD_CONTENTSIZE_UNKNOWN ||
+		    size > SIZE_MAX - total) {
+			free(job.frames);
+			return decompress_zstd_stream(data, length, limit);
+		}
+		if (limit && size > limit - total) {
+			free(job.frames);
+			errno = EFBIG;
+			return out;
+		}
+
+		if (job.count == alloc) {
+			alloc = alloc ? 2 * alloc : 64;
+			struct zstd_frame *p = realloc(job.frames,
+						       alloc * sizeof(*p));
+			if (p == NULL) {
+				free(job.frames);
+				return out;
+			}
+			job.frames = p;
+		}
+		struct zstd_frame *f = &job.frames[job.count++];
+		f->src = data + pos;
+		f->src_size = src_size;
+		f->offset = total;
+		f->size = size;
+		total += size;
+		pos += src_size;
+	}
+
+	if (total == 0) {
+		free(job.frames);
+		errno = EINVAL;
+		return out;
+	}
+
+	out = mmap_anonymous(total);
+	if (out.state == mmap_state_error) {
+		free(job.frames);
+		return out;
+	}
+	job.out = out.data;
+
+	if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if ((size_t)threads > job.count) threads = job.count;
+	if (threads < 1) threads = 1;
+
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	if (workers == NULL) {
+		free(job.frames);
+		mmap_close(&out);
+		out.state = mmap_state_error;
+		errno = ENOMEM;
+		return out;
+	}
+	pthread_mutex_init(&job.lock, NULL);
+
+	// The calling thread is a worker too.
+	int started = 0;
+	for (; started < threads - 1; started++) {
+		if (pthread_create(&workers[started], NULL,
+				   decompress_zstd_worker, &job)) break;
+	}
+	decompress_zstd_worker(&job);
+	for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+	free(workers);
+	free(job.frames);
+
+	if (job.failed) {
+		mmap_close(&out);
+		out.state = mmap_state_error;
+		errno = job.failed;
+	}
+	return out;
+}
+
+/**
+ * Decompresses data to anonymous memory, see mmap_anonymous(). Zstd frames
+ * having their size in the frame header are decompressed with given
+ * number of threads, or one per CPU if threads is 0. Output longer than
+ * limit bytes is an error, 0 for no limit. In case of error, struct member
+ * state is set to mmap_state_error and errno is set, to EINVAL if the data
+ * is corrupted and to EFBIG if it is over the limit.
+ */
+struct mmap_info decompress(const void *data, size_t length, int threads,
+			    size_t limit)
+{
+	struct mmap_info out;
+
+	switch (decompress_detect(data, length)) {
+	case decompress_gzip:
+		return decompress_gzip_data(data, length, limit);
+	case decompress_zstd:
+		return decompress_zstd_data(data, length, threads, limit);
+	default:
+		out.state = mmap_state_error;
+		errno = EINVAL;
+		return out;
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H   1
+
+/**
+ * Decompression of gzip and zstd input to memory, so compressed documents
+ * can be parsed without a temporary file. Frames of multi-frame zstd input
+ * are decompressed in parallel.
+ */
+
+#include <stddef.h>
+#include "mmap.h"
+
+enum decompress_format {
+	decompress_none,  // not compressed, or in an unknown format
+	decompress_gzip,  // gzip, possibly with many members
+	decompress_zstd   // zstd, possibly with many frames
+};
+
+/**
+ * Detects compression from the magic bytes at the beginning of data.
+ */
+enum decompress_format decompress_detect(const void *data, size_t length);
+
+/**
+ * Decompresses data to anonymous memory, see mmap_anonymous(). Zstd frames
+ * having their size in the frame header are decompressed with given
+ * number of threads, or one per CPU if threads is 0. Output longer than
+ * limit bytes is an error, 0 for no limit. In case of error, struct member
+ * state is set to mmap_state_error and errno is set, to EINVAL if the data
+ * is corrupted and to EFBIG if it is over the limit.
+ */
+struct mmap_info decompress(const void *data, size_t length, int threads,
+			    size_t limit);
+
+#endif /* decompress.h */
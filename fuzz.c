@@ -0,0 +1,334 @@
+/**
+ * Fuzzing entry points for the UTF-8 decoder, the header reader and the
+ * full parser. Compile with one of FUZZ_UTF8, FUZZ_HEADER or FUZZ_PARSE
+ * defined. The entry point is LLVMFuzzerTestOneInput() which works with
+ * libFuzzer and AFL++. With FUZZ_STANDALONE defined, main() runs the entry
+ * point for every file given on the command line, which is handy for
+ * replaying crashes with sanitizers. See 'make fuzz' and 'make replay'.
+ * Seed inputs are in tests/fuzz/ by target, and 'make check' replays them.
+ *
+ * Every target is differential too: the result is compared against a
+ * reference path and a mismatch aborts, so the fuzzer reports it like a
+ * crash. When adding a fast path to the decoder or the parser, keep the
+ * simple one as the reference here.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for open_memstream()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <libxml/parser.h>
+
+#include "utf8.h"
+#include "cgm_error.h"
+#include "cgm_emitter.h"
+#include "cgm.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/**
+ * Aborts with a message if the condition is false.
+ */
+static void fuzz_assert(int cond, const char *msg)
+{
+	if (cond) return;
+	fprintf(stderr, "Differential check failed: %s\n", msg);
+	abort();
+}
+
+#if defined(FUZZ_UTF8)
+
+/**
+ * Reference decoder. Written directly from the description of
+ * utf8_to_unicode() in utf8.h without any tricks.
+ */
+static int ref_utf8_to_unicode(unsigned char **buf, unsigned char *endptr)
+{
+	if (*buf >= endptr) return UTF8_ERR_NO_DATA;
+
+	unsigned char first = *(*buf)++;
+	int bytes = utf8_chrlen(first);
+	if (bytes == UTF8_ERR_INVALID_BYTE) return UTF8_ERR_INVALID_BYTE;
+
+	int code = bytes == 1 ? first : first & (0x7f >> bytes);
+	for (int i = 1; i < bytes; i++) {
+		if (*buf == endptr) return UTF8_ERR_TRUNCATED_BYTE;
+		unsigned char byte = *(*buf)++;
+		if ((byte & 0xc0) != 0x80) return UTF8_ERR_INVALID_BYTE;
+		code = (code << 6) | (byte & 0x3f);
+	}
+
+	// Shortest form only
+	if ((bytes == 2 && code < 0x80) || (bytes == 3 && code < 0x800) ||
+	    (bytes == 4 && code < 0x10000)) return UTF8_ERR_INVALID_BYTE;
+	return code;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	unsigned char *end = (unsigned char *)data + size;
+	unsigned char *p = (unsigned char *)data;
+	unsigned char *ref_p = p;
+
+	while (1) {
+		int code = utf8_to_unicode(&p, end);
+		int ref_code = ref_utf8_to_unicode(&ref_p, end);
+
+		fuzz_assert(code == ref_code, "decoded value");
+		fuzz_assert(p == ref_p, "position after decoding");
+		fuzz_assert(p <= end, "decoder went past the buffer");
+		if (code == UTF8_ERR_NO_DATA) break;
+	}
+
+	return 0;
+}
+
+#elif defined(FUZZ_HEADER)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct cgm_info cgm;
+	cgm.p = (unsigned char *)data;
+	cgm.endptr = cgm.p + size;
+	cgm.unicode.newline = '\n';
+	cgm.unicode.tab = '\t';
+	cgm.unicode.space = ' ';
+
+	cgm_read_header(&cgm);
+
+	fuzz_assert(cgm.p >= data && cgm.p <= cgm.endptr,
+		    "header reader went past the buffer");
+	fuzz_assert(cgm_error.code >= cgm_no_error &&
+		    cgm_error.code < cgm_error_code_count, "error code");
+
+	return 0;
+}
+
+#elif defined(FUZZ_PARSE)
+
+struct fuzz_output {
+	FILE *mem;
+	char *data;
+	size_t size;
+	int error;
+};
+
+/**
+ * Parses the input with given emitter writing to memory.
+ */
+static struct fuzz_output fuzz_parse(const uint8_t *data, size_t size,
+				     const char *format, int streaming,
+				     const char *path)
+{
+	struct fuzz_output out;
+	struct cgm_emitter emitter;
+	struct cgm_options options = { path, 1, 0 }; // No thread pool per input
+
+	out.mem = open_memstream(&out.data, &out.size);
+	if (out.mem == NULL) abort();
+
+	if (strcmp(format, "json") == 0)
+		emitter = cgm_json_emitter(out.mem);
+	else if (strcmp(format, "binary") == 0)
+		emitter = cgm_binary_emitter(out.mem);
+	else
+		emitter = cgm_xml_emitter(out.mem, streaming);
+	if (emitter.data == NULL) abort();
+
+	cgm_parse_buffer(data, size, "fuzz", &options, &emitter);
+	out.error = cgm_error.code;
+
+	emitter.close(emitter.data);
+	fclose(out.mem);
+	return out;
+}
+
+// Path of the filtered parse, also split for the reference. No part may be
+// "block" because text lines have that name but never match.
+static const char *const fuzz_path = "person/info";
+static const char *const fuzz_path_parts[] = { "person", "info" };
+static const int fuzz_path_count = 2;
+
+struct fuzz_events {
+	FILE *out;
+	int prune;      // keep only the subtrees at fuzz_path
+	int depth;      // elements open
+	int matched;    // open elements matching the beginning of the path
+	int keep_depth; // depth of the kept subtree, -1 if outside of one
+};
+
+/**
+ * Writes events as "S<length>:name", "T<length>:text" and "E". Pruning is
+ * the reference of the path filter: it sees the whole document and only
+ * drops events, without any of the skipping of the parser.
+ */
+static void events_start_document(void *data, const char *original)
+{
+	(void)data;
+	(void)original;
+}
+
+static void events_start_element(void *data, int id,
+				 const unsigned char *name, int name_length)
+{
+	struct fuzz_events *ev = data;
+	(void)id;
+
+	if (ev->prune && ev->keep_depth == -1) {
+		const char *part = fuzz_path_parts[ev->matched];
+		if (ev->depth == ev->matched && ev->matched < fuzz_path_count &&
+		    (int)strlen(part) == name_length &&
+		    memcmp(part, name, name_length) == 0) {
+			ev->matched++;
+			if (ev->matched == fuzz_path_count)
+				ev->keep_depth = ev->depth;
+		}
+		if (ev->keep_depth == -1) {
+			ev->depth++;
+			return;
+		}
+	}
+
+	fprintf(ev->out, "S%d:", name_length);
+	fwrite(name, 1, name_length, ev->out);
+	ev->depth++;
+}
+
+static void events_text(void *data, const unsigned char *text, int length)
+{
+	struct fuzz_events *ev = data;
+
+	if (ev->prune && ev->keep_depth == -1) return;
+	fprintf(ev->out, "T%d:", length);
+	fwrite(text, 1, length, ev->out);
+}
+
+static void events_end_element(void *data)
+{
+	struct fuzz_events *ev = data;
+
+	ev->depth--;
+	if (ev->matched > ev->depth) ev->matched = ev->depth;
+	if (ev->prune && ev->keep_depth == -1) return;
+	if (ev->keep_depth == ev->depth) ev->keep_depth = -1;
+	putc('E', ev->out);
+}
+
+static void events_end_document(void *data)
+{
+	(void)data;
+}
+
+static int events_close(void *data)
+{
+	(void)data;
+	return 0;
+}
+
+/**
+ * Parses the input to events. If prune is non-zero, the whole document is
+ * parsed and pruned to fuzz_path. Otherwise the parser filters it.
+ */
+static struct fuzz_output fuzz_events(const uint8_t *data, size_t size,
+				      int prune)
+{
+	struct fuzz_output out;
+	struct fuzz_events ev = { NULL, prune, 0, 0, -1 };
+	struct cgm_options options = { prune ? NULL : fuzz_path, 1, 0 };
+	struct cgm_emitter emitter = {
+		&ev, events_start_document, events_start_element,
+		events_text, events_end_element, events_end_document,
+		events_close
+	};
+
+	out.mem = open_memstream(&out.data, &out.size);
+	if (out.mem == NULL) abort();
+	ev.out = out.mem;
+
+	cgm_parse_buffer(data, size, "fuzz", &options, &emitter);
+	out.error = cgm_error.code;
+
+	fclose(out.mem);
+	return out;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct fuzz_output tree = fuzz_parse(data, size, "xml", 0, NULL);
+	struct fuzz_output stream = fuzz_parse(data, size, "xml", 1, NULL);
+	struct fuzz_output json = fuzz_parse(data, size, "json", 0, NULL);
+	struct fuzz_output binary = fuzz_parse(data, size, "binary", 0, NULL);
+
+	// Skipped subtrees are not validated, so only a valid document
+	// must give the same result both ways.
+	struct fuzz_output pruned = fuzz_events(data, size, 1);
+	struct fuzz_output filtered = fuzz_events(data, size, 0);
+	if (pruned.error == cgm_no_error)
+		fuzz_assert(filtered.error == cgm_no_error &&
+			    pruned.size == filtered.size &&
+			    memcmp(pruned.data, filtered.data,
+				   pruned.size) == 0,
+			    "filtered and pruned output");
+	free(pruned.data);
+	free(filtered.data);
+
+	fuzz_assert(tree.error == stream.error &&
+		    tree.error == json.error &&
+		    tree.error == binary.error, "error codes of emitters");
+
+	// The output is complete only if the document was valid.
+	if (tree.error == cgm_no_error)
+		fuzz_assert(tree.size == stream.size &&
+			    memcmp(tree.data, stream.data, tree.size) == 0,
+			    "streaming and tree XML output");
+
+	free(tree.data);
+	free(stream.data);
+	free(json.data);
+	free(binary.data);
+	return 0;
+}
+
+#else
+#error "Define FUZZ_UTF8, FUZZ_HEADER or FUZZ_PARSE"
+#endif
+
+#ifdef FUZZ_STANDALONE
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s INPUT_FILE...\n", argv[0]);
+		return 1;
+	}
+
+	// Plain stdio because mmap can not map empty files.
+	for (int i = 1; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		if (f == NULL) {
+			perror(argv[i]);
+			return 1;
+		}
+
+		uint8_t *data = NULL;
+		size_t size = 0, alloc = 0;
+		while (!feof(f) && !ferror(f)) {
+			if (size == alloc) {
+				alloc = alloc ? 2 * alloc : 4096;
+				data = realloc(data, alloc);
+				if (data == NULL) abort();
+			}
+			size += fread(data + size, 1, alloc - size, f);
+		}
+		fclose(f);
+
+		LLVMFuzzerTestOneInput(data, size);
+		free(data);
+	}
+
+	return 0;
+}
+
+#endif
@@ -12,11 +12,14 @@
  * Codegrove's mmapping library. 
  */
 
+#define _GNU_SOURCE // for madvise() and mremap()
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <errno.h>
 #include "mmap.h"
 
 /**
@@ -49,6 +52,9 @@ struct mmap_info mmap_fopen(const char *pathname, enum mmap_mode mode)
 		mmap_prot = PROT_READ | PROT_WRITE;
 		mmap_flags = MAP_PRIVATE;
 		break;
+	default:
+		errno = EINVAL;
+		return info;
 	}
 
 	// Opening a file as we do normally.
@@ -60,6 +66,7 @@ struct mmap_info mmap_fopen(const char *pathname, enum mmap_mode mode)
 	ret = fstat(info.fd, &stats);
 	if (ret == -1) return info;
 	info.length = stats.st_size;
+	info.discarded = 0;
 
 	// Doing some black bit magic with mmap.
 	info.data = mmap(NULL, info.length, mmap_prot, mmap_flags, info.fd, 0);
@@ -69,6 +76,42 @@ struct mmap_info mmap_fopen(const char *pathname, enum mmap_mode mode)
 	return info;
 }
 
+/**
+ * Maps length bytes of anonymous memory, for example for data decompressed
+ * from a file. The memory is readable, writable and initially zero. File
+ * descriptor is -1. Errors are reported like in mmap_fopen().
+ */
+struct mmap_info mmap_anonymous(off_t length)
+{
+	struct mmap_info info;
+	info.state = mmap_state_error; // Reset if everything is ok.
+	info.fd = -1;
+	info.length = length;
+	info.discarded = 0;
+
+	info.data = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (info.data == MAP_FAILED) return info;
+
+	info.state = mmap_state_open;
+	return info;
+}
+
+/**
+ * Changes the length of the mapping. The data may move, so pointers to it
+ * are not valid afterwards. Returns 0 on success and -1 on error. Errno is
+ * set in case of error and the mapping is left untouched.
+ */
+int mmap_resize(struct mmap_info *info, off_t length)
+{
+	void *data = mremap(info->data, info->length, length, MREMAP_MAYMOVE);
+	if (data == MAP_FAILED) return -1;
+
+	info->data = data;
+	info->length = length;
+	return 0;
+}
+
 /**
  * Closes the given mmapped file. Error can be read from info->state and errno.
  */
@@ -85,7 +128,28 @@ void mmap_close(struct mmap_info *info)
 	// In case of fail, continue anyway try to close the file.
 	// In that case close errno will overwrite this errno.
 
-	// Close the file.
+	// Close the file. Anonymous memory has none.
+	if (info->fd == -1) return;
 	ret = close(info->fd);
 	if (ret == -1) info->state = mmap_state_error;
 }
+
+/**
+ * Releases the memory of the whole pages before given offset. The data is
+ * still readable afterwards but it is read again from the file, or is zero
+ * in anonymous memory, so call this only for the data you are done with.
+ * Changes made to the data in mmap_mode_volatile_write are lost. Errors are
+ * ignored because this is just a hint to the kernel.
+ */
+void mmap_discard(struct mmap_info *info, off_t offset)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	off_t end = offset - offset % page_size;
+
+	// Already released pages are skipped
+	if (end <= info->discarded) return;
+
+	madvise((char *)info->data + info->discarded, end - info->discarded,
+		MADV_DONTNEED);
+	info->discarded = end;
+}
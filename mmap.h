@@ -18,9 +18,10 @@ enum mmap_mode {
 };
 
 struct mmap_info {
-	int fd;                // fd of the mmap'd file
+	int fd;                // fd of the mmap'd file, -1 if anonymous
 	void *data;            // actual data
 	off_t length;          // length of the data
+	off_t discarded;       // bytes released with mmap_discard()
 	enum mmap_state state; // errno is maybe set additionally.
 };
 
@@ -32,9 +33,32 @@ struct mmap_info {
  */
 struct mmap_info mmap_fopen(const char *pathname, enum mmap_mode mode);
 
+/**
+ * Maps length bytes of anonymous memory, for example for data decompressed
+ * from a file. The memory is readable, writable and initially zero. File
+ * descriptor is -1. Errors are reported like in mmap_fopen().
+ */
+struct mmap_info mmap_anonymous(off_t length);
+
+/**
+ * Changes the length of the mapping. The data may move, so pointers to it
+ * are not valid afterwards. Returns 0 on success and -1 on error. Errno is
+ * set in case of error and the mapping is left untouched.
+ */
+int mmap_resize(struct mmap_info *info, off_t length);
+
 /**
  * Closes the given mmapped file. Error can be read from info->state and errno.
  */
 void mmap_close(struct mmap_info *info);
 
+/**
+ * Releases the memory of the whole pages before given offset. The data is
+ * still readable afterwards but it is read again from the file, or is zero
+ * in anonymous memory, so call this only for the data you are done with.
+ * Changes made to the data in mmap_mode_volatile_write are lost. Errors are
+ * ignored because this is just a hint to the kernel.
+ */
+void mmap_discard(struct mmap_info *info, off_t offset);
+
 #endif /* mmap.h */
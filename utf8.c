@@ -135,7 +135,8 @@ utf8_string utf8_literal_to_string(const char* literal)
  * the next call of this function. Endptr is a pointer to the next byte after
  * the last character in the buffer (buf_start_pointer+buf_length). If an
  * error occurs, UTF8_ERR_* is returned and *buf is at the next character
- * after the errorneous byte. 
+ * after the errorneous byte. Overlong encodings are invalid, so newline,
+ * space and tab are always single bytes.
  */
 int utf8_to_unicode(unsigned char **buf, unsigned char *endptr)
 {
@@ -147,8 +148,12 @@ int utf8_to_unicode(unsigned char **buf, unsigned char *endptr)
 	const unsigned char left_5 = 0xf8;  // 11111000
 	const unsigned char right_6 = 0x3f; // 00111111
 
+	// Smallest code of each length. Anything smaller is an overlong
+	// encoding, eg. C0 8A for a newline, and not valid UTF-8.
+	static const int min_code[] = { 0, 0, 0x80, 0x800, 0x10000 };
+
 	int code = 0;
-	int bytes, byte;
+	int bytes, byte, length;
 
 	// Take a byte, move to the next.
 	if (*buf >= endptr) return UTF8_ERR_NO_DATA; // Out of buffer.
@@ -176,6 +181,7 @@ int utf8_to_unicode(unsigned char **buf, unsigned char *endptr)
 	}
 
 	// Take the unicode from the trailing bytes.
+	length = bytes;
 	while (--bytes) {
 		// Take a byte, move to the next.
 		if (*buf == endptr) return UTF8_ERR_TRUNCATED_BYTE;
@@ -188,6 +194,7 @@ int utf8_to_unicode(unsigned char **buf, unsigned char *endptr)
 		code <<= 6; // make space for 6 bits
 		code |= ( byte & right_6 );
 	}
-	
+
+	if (code < min_code[length]) return UTF8_ERR_INVALID_BYTE;
 	return code;
 }
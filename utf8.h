@@ -62,7 +62,8 @@ utf8_string utf8_literal_to_string(const char* literal);
  * the next call of this function. Endptr is a pointer to the next byte after
  * the last character in the buffer (buf_start_pointer+buf_length). If an
  * error occurs, UTF8_ERR_* is returned and *buf is at the next character
- * after the errorneous byte. 
+ * after the errorneous byte. Overlong encodings are invalid, so newline,
+ * space and tab are always single bytes.
  */
 int utf8_to_unicode(unsigned char **buf, unsigned char *endptr);
 